@@ -3,7 +3,12 @@
 mkdir -p build
 
 glslangValidator -V shaders/heart.vert -o shaders/heart.vert.spv
+glslangValidator -V shaders/triangle.vert -o shaders/triangle.vert.spv
 glslangValidator -V shaders/heart.frag -o shaders/heart.frag.spv
+glslangValidator -V shaders/particles.comp -o shaders/particles.comp.spv
+glslangValidator -V shaders/sprite.vert -o shaders/sprite.vert.spv
+glslangValidator -V shaders/sprite.frag -o shaders/sprite.frag.spv
+glslangValidator -V shaders/sprite_bindless.frag -o shaders/sprite_bindless.frag.spv
 
 COMMON_FLAGS="-D VKH_DEBUG -g -fno-exceptions -fno-rtti --std=c++17"
 
@@ -11,3 +16,8 @@ clang++ $COMMON_FLAGS vkh_game.cpp -shared -o ./build/vkh_game.so.tmp
 clang++ $COMMON_FLAGS vkh_platform_sdl.cpp -o ./build/vkh_platform -lSDL3 -lvulkan
 
 mv ./build/vkh_game.so.tmp ./build/vkh_game.so
+
+# No FMA contraction, the scalar reference has to stay unfused
+clang++ -O2 -ffp-contract=off -fno-exceptions -fno-rtti --std=c++17 vkh_math_bench.cpp -o ./build/vkh_math_bench
+
+clang++ -O2 -fno-exceptions -fno-rtti --std=c++17 vkh_image_bench.cpp -o ./build/vkh_image_bench
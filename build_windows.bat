@@ -3,7 +3,12 @@
 mkdir build
 
 glslangValidator -V shaders\heart.vert -o shaders\heart.vert.spv
+glslangValidator -V shaders\triangle.vert -o shaders\triangle.vert.spv
 glslangValidator -V shaders\heart.frag -o shaders\heart.frag.spv
+glslangValidator -V shaders\particles.comp -o shaders\particles.comp.spv
+glslangValidator -V shaders\sprite.vert -o shaders\sprite.vert.spv
+glslangValidator -V shaders\sprite.frag -o shaders\sprite.frag.spv
+glslangValidator -V shaders\sprite_bindless.frag -o shaders\sprite_bindless.frag.spv
 
 set COMMON_CXX_FLAGS=-DVKH_DEBUG --std=c++17 -Wall -Wno-unused-variable -g -fno-exceptions -fno-rtti
 
@@ -33,3 +38,8 @@ clang++ ^
     -lvulkan-1 ^
     -lSDL3 ^
     -luser32 -lgdi32 -lshell32 -lmsvcrt -Xlinker /NODEFAULTLIB:libcmt -Xlinker /INCREMENTAL:NO
+
+rem No FMA contraction, the scalar reference has to stay unfused
+clang++ -O2 -ffp-contract=off -fno-exceptions -fno-rtti --std=c++17 vkh_math_bench.cpp -o .\build\vkh_math_bench.exe
+
+clang++ -O2 -fno-exceptions -fno-rtti --std=c++17 vkh_image_bench.cpp -o .\build\vkh_image_bench.exe
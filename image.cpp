@@ -2,61 +2,444 @@
 
 #include <cstdio>
 
-Image loadBMP(const char *filename) {
-    Image image = {0, 0, 0, 0};
+#if _WIN64
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-    FILE *file = 0;
+// NOTE: x86 builds don't enable SSSE3 or AVX2 globally, the kernels are
+// compiled for their instruction set with target attributes and picked
+// once at runtime. NEON is part of every ARM64 target.
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if _WIN64
+#include <intrin.h>
+#endif
+#define IMAGE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+MappedFile mapFile(const char *filename) {
+    MappedFile result = {};
 
 #if _WIN64
-    fopen_s(&file, filename, "rb");
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return result;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping) {
+            result.data =
+                (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            result.size = result.data ? (size_t)size.QuadPart : 0;
+            result.mapping = mapping;
+        }
+    }
+    // The mapping keeps the file open
+    CloseHandle(file);
 #else
-    file = fopen(filename, "rb");
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return result;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // Decoding walks the file front to back
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            result.data = (const uint8_t *)data;
+            result.size = st.st_size;
+        }
+    }
+    // The mapping keeps the file open
+    close(fd);
 #endif
 
-    if (!file) {
-        fprintf(stderr, "Error: could not open file %s\n", filename);
+    return result;
+}
+
+void unmapFile(MappedFile *file) {
+#if _WIN64
+    if (file->data) {
+        UnmapViewOfFile(file->data);
     }
+    if (file->mapping) {
+        CloseHandle(file->mapping);
+    }
+#else
+    if (file->data) {
+        munmap((void *)file->data, file->size);
+    }
+#endif
+    *file = {};
+}
+
+static uint16_t getU16(const uint8_t *p) { return p[0] | (p[1] << 8); }
 
-    unsigned char header[54];
-    if (fread(header, 1, 54, file) != 54) {
-        fprintf(stderr, "Error: could not read BMP header\n");
+static uint32_t getU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+const uint32_t BMP_MAX_DIMENSION = 1 << 15;
+const uint32_t BMP_BI_RGB = 0;
+const uint32_t BMP_BI_BITFIELDS = 3;
+
+bool parseBMP(const uint8_t *file, size_t size, BMPInfo *info) {
+    *info = {};
+
+    // File header (14 bytes) and at least a BITMAPINFOHEADER (40 bytes)
+    if (size < 54 || file[0] != 'B' || file[1] != 'M') {
+        fprintf(stderr, "Error: not a BMP file\n");
+        return false;
+    }
+
+    uint32_t pixel_offset = getU32(&file[0x0A]);
+    uint32_t header_size = getU32(&file[0x0E]);
+    int32_t width = (int32_t)getU32(&file[0x12]);
+    int32_t height = (int32_t)getU32(&file[0x16]);
+    uint16_t planes = getU16(&file[0x1A]);
+    uint16_t bits_per_pixel = getU16(&file[0x1C]);
+    uint32_t compression = getU32(&file[0x1E]);
+
+    if (header_size < 40 || planes != 1 ||
+        (bits_per_pixel != 24 && bits_per_pixel != 32)) {
+        fprintf(stderr, "Error: unsupported BMP (%u bits per pixel)\n",
+                bits_per_pixel);
+        return false;
+    }
+
+    // Only BGR(A) channel order, which is what every writer produces
+    bool has_alpha = false;
+    if (compression == BMP_BI_BITFIELDS && bits_per_pixel == 32) {
+        if (size < 0x42 || getU32(&file[0x36]) != 0x00FF0000 ||
+            getU32(&file[0x3A]) != 0x0000FF00 ||
+            getU32(&file[0x3E]) != 0x000000FF) {
+            fprintf(stderr, "Error: unsupported BMP channel masks\n");
+            return false;
+        }
+        // V3 and later headers carry an alpha mask, older ones have none
+        has_alpha = header_size >= 56 && size >= 0x46 &&
+                    getU32(&file[0x42]) == 0xFF000000;
+    } else if (compression != BMP_BI_RGB) {
+        fprintf(stderr, "Error: compressed BMPs are not supported\n");
+        return false;
+    }
+
+    // INT32_MIN has no positive counterpart, the bound check rejects it
+    int64_t abs_height = height < 0 ? -(int64_t)height : height;
+    if (width <= 0 || abs_height == 0 || width > (int32_t)BMP_MAX_DIMENSION ||
+        abs_height > BMP_MAX_DIMENSION) {
+        fprintf(stderr, "Error: bad BMP size %d x %d\n", width, height);
+        return false;
+    }
+
+    info->width = width;
+    info->height = (uint32_t)abs_height;
+    info->bytes_per_pixel = bits_per_pixel / 8;
+    info->row_stride = ((uint64_t)width * info->bytes_per_pixel + 3) & ~3ull;
+    info->pixel_offset = pixel_offset ? pixel_offset : 54;
+    info->bottom_up = height > 0;
+    info->has_alpha = has_alpha;
+
+    // The last row needs no padding, some writers leave it out
+    uint64_t pixels_size = info->row_stride * (info->height - 1) +
+                           (uint64_t)width * info->bytes_per_pixel;
+    if (info->pixel_offset < 54 || info->pixel_offset > size ||
+        pixels_size > size - info->pixel_offset) {
+        fprintf(stderr, "Error: BMP pixel data is truncated\n");
+        return false;
+    }
+
+    return true;
+}
+
+enum ImageKernel {
+    IMAGE_KERNEL_SCALAR,
+    IMAGE_KERNEL_SSSE3,
+    IMAGE_KERNEL_AVX2,
+    IMAGE_KERNEL_COUNT,
+};
+
+const char *IMAGE_KERNEL_NAMES[IMAGE_KERNEL_COUNT] = {"scalar", "SSSE3",
+                                                       "AVX2"};
+
+#if IMAGE_X86 && _WIN64
+// __builtin_cpu_supports needs compiler-rt, which the MSVC target doesn't
+// link. AVX2 also needs the OS to save YMM state, XCR0 says whether it does.
+__attribute__((target("xsave"))) static ImageKernel detectImageKernel() {
+    int regs[4];
+    __cpuid(regs, 0);
+    int max_leaf = regs[0];
+
+    __cpuid(regs, 1);
+    bool ssse3 = regs[2] & (1 << 9);
+    bool os_avx = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) &&
+                  (_xgetbv(0) & 6) == 6;
+
+    bool avx2 = false;
+    if (os_avx && max_leaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        avx2 = regs[1] & (1 << 5);
+    }
+
+    return avx2 ? IMAGE_KERNEL_AVX2 : ssse3 ? IMAGE_KERNEL_SSSE3
+                                            : IMAGE_KERNEL_SCALAR;
+}
+#elif IMAGE_X86
+static ImageKernel detectImageKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return IMAGE_KERNEL_AVX2;
     }
+    if (__builtin_cpu_supports("ssse3")) {
+        return IMAGE_KERNEL_SSSE3;
+    }
+    return IMAGE_KERNEL_SCALAR;
+}
+#else
+static ImageKernel detectImageKernel() { return IMAGE_KERNEL_SCALAR; }
+#endif
 
-    if (header[0] != 'B' || header[1] != 'M') {
-        fprintf(stderr, "Error: invalid BMP file\n");
+// Detected once, later calls only read it
+static ImageKernel imageKernel() {
+    static ImageKernel kernel = detectImageKernel();
+    return kernel;
+}
+
+// NOTE: The row kernels turn BGR or BGRA into RGBA8 from pixel x on. Vector
+// loads never reach past the row's own pixels, the scalar loop finishes
+// the tail.
+static void convertPixelsBGR(const uint8_t *src, uint32_t *dst, uint32_t x,
+                             uint32_t width) {
+#if defined(__ARM_NEON)
+    for (; width - x >= 16; x += 16) {
+        uint8x16x3_t bgr = vld3q_u8(src + x * 3);
+        uint8x16x4_t rgba = {{bgr.val[2], bgr.val[1], bgr.val[0],
+                              vdupq_n_u8(255)}};
+        vst4q_u8((uint8_t *)(dst + x), rgba);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t *p = src + x * 3;
+        dst[x] = 0xFF000000u | (p[0] << 16) | (p[1] << 8) | p[2];
     }
+}
 
-    int dataPos = *(int *)&(header[0x0A]);
-    int imageSize = *(int *)&(header[0x22]);
-    image.width = *(int *)&(header[0x12]);
-    image.height = *(int *)&(header[0x16]);
+static void convertPixelsBGRA(const uint8_t *src, uint32_t *dst, uint32_t x,
+                              uint32_t width, bool has_alpha) {
+    uint32_t alpha_or = has_alpha ? 0 : 0xFF000000u;
+#if defined(__ARM_NEON)
+    for (; width - x >= 16; x += 16) {
+        uint8x16x4_t bgra = vld4q_u8(src + x * 4);
+        uint8x16x4_t rgba = {{bgra.val[2], bgra.val[1], bgra.val[0],
+                              has_alpha ? bgra.val[3] : vdupq_n_u8(255)}};
+        vst4q_u8((uint8_t *)(dst + x), rgba);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t *p = src + x * 4;
+        dst[x] = alpha_or | ((uint32_t)p[3] << 24) | (p[0] << 16) |
+                 (p[1] << 8) | p[2];
+    }
+}
 
-    if (imageSize == 0) {
-        imageSize = image.width * image.height;
+#if IMAGE_X86
+__attribute__((target("ssse3"))) static void convertRowBGRSSSE3(
+    const uint8_t *src, uint32_t *dst, uint32_t width) {
+    const __m128i shuffle =
+        _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    uint32_t x = 0;
+    for (; (uint64_t)(width - x) * 3 >= 16; x += 4) {
+        __m128i bgr = _mm_loadu_si128((const __m128i *)(src + x * 3));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+        _mm_storeu_si128((__m128i *)(dst + x), rgba);
     }
+    convertPixelsBGR(src, dst, x, width);
+}
 
-    if (dataPos == 0) {
-        dataPos = 54;
+__attribute__((target("avx2"))) static void convertRowBGRAVX2(
+    const uint8_t *src, uint32_t *dst, uint32_t width) {
+    // Two groups of four pixels, one per 128 bit lane. The second load
+    // starts 12 bytes in, so 28 bytes must be left.
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    uint32_t x = 0;
+    for (; (uint64_t)(width - x) * 3 >= 28; x += 8) {
+        const uint8_t *p = src + x * 3;
+        __m256i bgr = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+            _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+        __m256i rgba = _mm256_or_si256(_mm256_shuffle_epi8(bgr, shuffle),
+                                       alpha);
+        _mm256_storeu_si256((__m256i *)(dst + x), rgba);
     }
+    convertPixelsBGR(src, dst, x, width);
+}
 
-    image.data = new uint32_t[imageSize];
+__attribute__((target("ssse3"))) static void convertRowBGRASSSE3(
+    const uint8_t *src, uint32_t *dst, uint32_t width, bool has_alpha) {
+    const __m128i shuffle =
+        _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i alpha = _mm_set1_epi32(has_alpha ? 0 : (int)0xFF000000);
+    uint32_t x = 0;
+    for (; width - x >= 4; x += 4) {
+        __m128i bgra = _mm_loadu_si128((const __m128i *)(src + x * 4));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(bgra, shuffle), alpha);
+        _mm_storeu_si128((__m128i *)(dst + x), rgba);
+    }
+    convertPixelsBGRA(src, dst, x, width, has_alpha);
+}
 
-    fseek(file, dataPos, SEEK_SET);
+__attribute__((target("avx2"))) static void convertRowBGRAAVX2(
+    const uint8_t *src, uint32_t *dst, uint32_t width, bool has_alpha) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m256i alpha = _mm256_set1_epi32(has_alpha ? 0 : (int)0xFF000000);
+    uint32_t x = 0;
+    for (; width - x >= 8; x += 8) {
+        __m256i bgra = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+        __m256i rgba = _mm256_or_si256(_mm256_shuffle_epi8(bgra, shuffle),
+                                       alpha);
+        _mm256_storeu_si256((__m256i *)(dst + x), rgba);
+    }
+    convertPixelsBGRA(src, dst, x, width, has_alpha);
+}
+#endif
 
-    for (int y = 0; y < image.height; ++y) {
-        for (int x = 0; x < image.width; ++x) {
-            int i = x + y * image.width;
-            uint8_t B = fgetc(file);
-            uint8_t G = fgetc(file);
-            uint8_t R = fgetc(file);
-            uint8_t A = 255;
+// kernel must be one the CPU supports, see imageKernel
+static void decodeBMPRows(const uint8_t *file, const BMPInfo *info,
+                          uint32_t *dst, ImageKernel kernel) {
+    bool bgr = info->bytes_per_pixel == 3;
+    for (uint32_t y = 0; y < info->height; y++) {
+        // Bottom-up files store the last row first
+        uint32_t src_row = info->bottom_up ? info->height - 1 - y : y;
+        const uint8_t *src =
+            file + info->pixel_offset + src_row * info->row_stride;
+        uint32_t *row = dst + (uint64_t)y * info->width;
 
-            image.data[i] = (A << 24) | (B << 16) | (G << 8) | R;
+        switch (kernel) {
+#if IMAGE_X86
+            case IMAGE_KERNEL_AVX2: {
+                if (bgr) {
+                    convertRowBGRAVX2(src, row, info->width);
+                } else {
+                    convertRowBGRAAVX2(src, row, info->width, info->has_alpha);
+                }
+            } break;
+            case IMAGE_KERNEL_SSSE3: {
+                if (bgr) {
+                    convertRowBGRSSSE3(src, row, info->width);
+                } else {
+                    convertRowBGRASSSE3(src, row, info->width,
+                                        info->has_alpha);
+                }
+            } break;
+#endif
+            default: {
+                if (bgr) {
+                    convertPixelsBGR(src, row, 0, info->width);
+                } else {
+                    convertPixelsBGRA(src, row, 0, info->width,
+                                      info->has_alpha);
+                }
+            } break;
         }
     }
+}
 
-    fclose(file);
-    image.channels = 3;
+void decodeBMP(const uint8_t *file, const BMPInfo *info, uint32_t *dst) {
+    decodeBMPRows(file, info, dst, imageKernel());
+}
 
+Image loadBMP(const char *filename, MemoryArena *arena) {
+    Image image = {};
+
+    MappedFile file = mapFile(filename);
+    if (!file.data) {
+        fprintf(stderr, "Error: could not open file %s\n", filename);
+        return image;
+    }
+
+    BMPInfo info;
+    if (parseBMP(file.data, file.size, &info)) {
+        image.width = info.width;
+        image.height = info.height;
+        image.channels = info.has_alpha ? 4 : 3;
+        image.data = (uint32_t *)arena_push_aligned(
+            arena, (uint64_t)info.width * info.height * sizeof(uint32_t), 32);
+        decodeBMP(file.data, &info, image.data);
+    }
+
+    unmapFile(&file);
     return image;
 }
+
+static void putU16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void putU32(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+bool writeBMP(const char *filename, const uint32_t *pixels, uint32_t width,
+              uint32_t height) {
+    FILE *file = 0;
+
+#if _WIN64
+    fopen_s(&file, filename, "wb");
+#else
+    file = fopen(filename, "wb");
+#endif
+
+    if (!file) {
+        fprintf(stderr, "Error: could not open file %s\n", filename);
+        return false;
+    }
+
+    // 32 bit rows are always 4 byte aligned, no padding needed
+    uint32_t imageSize = width * height * 4;
+
+    unsigned char header[54] = {};
+    header[0] = 'B';
+    header[1] = 'M';
+    putU32(&header[0x02], 54 + imageSize);
+    putU32(&header[0x0A], 54);
+    putU32(&header[0x0E], 40);
+    putU32(&header[0x12], width);
+    putU32(&header[0x16], (uint32_t)(-(int32_t)height));  // top-down
+    putU16(&header[0x1A], 1);
+    putU16(&header[0x1C], 32);
+    putU32(&header[0x22], imageSize);
+
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+              fwrite(pixels, 1, imageSize, file) == imageSize;
+
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Error: could not write BMP %s\n", filename);
+    }
+
+    return ok;
+}
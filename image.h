@@ -1,12 +1,47 @@
+#include <cstddef>
 #include <cstdint>
 #ifndef IMAGE_H
 
+#include "vkh_memory.h"
+
 struct Image {
-    uint64_t width, height, channels;
-    uint32_t *data;
+    uint64_t width, height;
+    uint64_t channels;  // of the source, 3 when it had no alpha
+    uint32_t *data;     // RGBA8 (R in the lowest byte), top row first
+};
+
+// Read-only view of a whole file, see mapFile
+struct MappedFile {
+    const uint8_t *data;
+    size_t size;
+#if _WIN64
+    void *mapping;
+#endif
 };
 
-Image loadBMP(const char *filename);
+MappedFile mapFile(const char *filename);
+void unmapFile(MappedFile *file);
+
+// What decodeBMP needs from a validated header
+struct BMPInfo {
+    uint32_t width, height;
+    uint32_t bytes_per_pixel;  // 3 or 4
+    uint64_t pixel_offset;     // of the first row stored in the file
+    uint64_t row_stride;       // rows are padded to 4 bytes
+    bool bottom_up;
+    bool has_alpha;  // else alpha is forced to 255
+};
+
+// Accepts uncompressed 24 and 32 bit BMPs whose pixels lie within size
+bool parseBMP(const uint8_t *file, size_t size, BMPInfo *info);
+// dst holds width * height pixels, e.g. a mapped staging buffer
+void decodeBMP(const uint8_t *file, const BMPInfo *info, uint32_t *dst);
+// Pixels are pushed onto arena. Returns a zeroed Image on failure.
+Image loadBMP(const char *filename, MemoryArena *arena);
+
+// Writes a top-down 32-bit BMP, pixels are BGRA8 (B in the lowest byte)
+bool writeBMP(const char *filename, const uint32_t *pixels, uint32_t width,
+              uint32_t height);
 
 #define IMAGE_H
 #endif
@@ -1,19 +1,23 @@
 #version 450
 
-layout(binding = 0) uniform UniformBufferObject {
+layout(push_constant) uniform ViewPushConstants {
+    mat4 view_proj;
+} view;
+
+layout(binding = 0) uniform DrawUniforms {
     mat4 model;
-    mat4 view;
-    mat4 proj;
-} ubo;
+} draw;
 
 layout(location = 0) in vec2 inPosition;
 
-layout(location = 1) in mat4 instanceTransform;
-layout(location = 5) in vec3 instanceColor;
+layout(location = 1) in vec2 instancePosition;
+layout(location = 2) in vec2 instanceSize;
+layout(location = 3) in vec4 instanceColor;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) out vec4 fragColor;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * instanceTransform * vec4(inPosition, 0.0, 1.0);
+    vec2 position = inPosition * instanceSize + instancePosition;
+    gl_Position = view.view_proj * draw.model * vec4(position, 0.0, 1.0);
     fragColor = instanceColor;
 }
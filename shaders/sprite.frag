@@ -0,0 +1,12 @@
+#version 450
+
+layout(binding = 1) uniform sampler2D atlas;
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(atlas, fragUV) * fragColor;
+}
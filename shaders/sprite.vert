@@ -0,0 +1,29 @@
+#version 450
+
+layout(push_constant) uniform ViewPushConstants {
+    mat4 view_proj;
+} view;
+
+layout(binding = 0) uniform DrawUniforms {
+    mat4 model;
+} draw;
+
+layout(location = 0) in vec2 inPosition;
+
+layout(location = 1) in vec2 instancePosition;
+layout(location = 2) in vec2 instanceSize;
+layout(location = 3) in vec4 instanceColor;
+layout(location = 4) in vec4 instanceUVRect;
+layout(location = 5) in uint instanceTexture;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragTexture;
+
+void main() {
+    vec2 position = inPosition * instanceSize + instancePosition;
+    gl_Position = view.view_proj * draw.model * vec4(position, 0.0, 1.0);
+    fragColor = instanceColor;
+    fragUV = mix(instanceUVRect.xy, instanceUVRect.zw, inPosition);
+    fragTexture = instanceTexture;
+}
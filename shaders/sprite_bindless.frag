@@ -0,0 +1,16 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Must match BINDLESS_TEXTURE_CAPACITY, slots without a texture are never
+// sampled
+layout(binding = 2) uniform sampler2D textures[1024];
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUV;
+layout(location = 2) flat in uint fragTexture;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(textures[nonuniformEXT(fragTexture)], fragUV) * fragColor;
+}
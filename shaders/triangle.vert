@@ -0,0 +1,19 @@
+#version 450
+
+layout(push_constant) uniform ViewPushConstants {
+    mat4 view_proj;
+} view;
+
+layout(binding = 0) uniform DrawUniforms {
+    mat4 model;
+} draw;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec4 inColor;
+
+layout(location = 0) out vec4 fragColor;
+
+void main() {
+    gl_Position = view.view_proj * draw.model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+}
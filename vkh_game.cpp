@@ -10,6 +10,9 @@
 #define ASSERT(expr)
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "vkh_game.h"
 
 #include "vkh_math.cpp"
@@ -20,78 +23,264 @@ f32 random_float() {
     return ((f32)rand() / (f32)RAND_MAX) - 0.5f;
 }
 
-void SpawnParticles(GameState *game_state, vec2 mouse_position, f32 scaling_factor) {
-    game_state->particles.num_of_particles = 10000;
-    // TODO: Particle storage!
-    game_state->particles.positions = (vec2 *)malloc(game_state->particles.num_of_particles * sizeof(vec2));
-    game_state->particles.velocities = (vec2 *)malloc(game_state->particles.num_of_particles * sizeof(vec2));
-    game_state->particles.colors = (vec3 *)malloc(game_state->particles.num_of_particles * sizeof(vec3));
+// Every live particle is an instance in the renderer's frame, keep room for
+// the rest of the frame's entries so none of them are dropped
+const u32 MAX_PARTICLES = MAX_FRAME_INSTANCES - (1 << 16);
 
-    for (u32 i = 0; i < game_state->particles.num_of_particles; i++) {
+void InitParticlePool(ParticlePool *pool, MemoryArena *arena, u32 capacity) {
+    capacity = (capacity + 7) & ~7u;
+    pool->capacity = capacity;
+    pool->count = 0;
 
-        game_state->particles.positions[i].x = mouse_position.x * scaling_factor;
-        game_state->particles.positions[i].y = mouse_position.y * scaling_factor;
-        game_state->particles.velocities[i] = {random_float(), random_float()};
-        game_state->particles.colors[i] = {random_float()+0.5f, random_float()+0.5f, random_float()+0.5f};
+    f32 **float_arrays[] = {&pool->x, &pool->y, &pool->vx, &pool->vy,
+                            &pool->life};
+    for (u32 i = 0; i < sizeof(float_arrays) / sizeof(float_arrays[0]); i++) {
+        *float_arrays[i] =
+            (f32 *)arena_push_aligned(arena, capacity * sizeof(f32), 32);
+        memset(*float_arrays[i], 0, capacity * sizeof(f32));
     }
+    pool->color = (u32 *)arena_push_aligned(arena, capacity * sizeof(u32), 32);
+}
+
+u32 random_color() {
+    u32 r = (u32)((random_float() + 0.5f) * 255.0f);
+    u32 g = (u32)((random_float() + 0.5f) * 255.0f);
+    u32 b = (u32)((random_float() + 0.5f) * 255.0f);
+    return (255u << 24) | (b << 16) | (g << 8) | r;
 }
 
-void UpdateParticles(GameState *game_state, f32 delta_time) {
-    for (u32 i = 0; i < game_state->particles.num_of_particles; i++) {
-        game_state->particles.positions[i].x += game_state->particles.velocities[i].x * delta_time;
-        game_state->particles.positions[i].y += game_state->particles.velocities[i].y * delta_time;
+u32 ConsumeSpawnCount(ParticleEmitter *emitter, f32 dt) {
+    emitter->spawn_accumulator += emitter->spawn_rate * dt;
+    u32 spawn_count = (u32)emitter->spawn_accumulator;
+    emitter->spawn_accumulator -= (f32)spawn_count;
+    return spawn_count;
+}
+
+void EmitParticles(ParticlePool *pool, ParticleEmitter *emitter, f32 dt) {
+    u32 spawn_count = ConsumeSpawnCount(emitter, dt);
+
+    u32 free_slots = pool->capacity - pool->count;
+    if (spawn_count > free_slots) {
+        spawn_count = free_slots;
+    }
+
+    for (u32 n = 0; n < spawn_count; n++) {
+        u32 i = pool->count++;
+        pool->x[i] = emitter->position.x;
+        pool->y[i] = emitter->position.y;
+        pool->vx[i] = random_float() * emitter->speed;
+        pool->vy[i] = random_float() * emitter->speed;
+        pool->life[i] = emitter->lifetime * (random_float() + 1.0f);
+        pool->color[i] = random_color();
     }
 }
 
-void DrawParticles(GameState *game_state) {
-    for (u32 i = 0; i < game_state->particles.num_of_particles; i++) {
-        vec2 position = game_state->particles.positions[i];
-        f32 width = 100.0f;
-        f32 height = 100.0f;
-        f32 x = position.x - width / 2.0f;
-        f32 y = position.y - height / 2.0f;
-        DrawRectangle(&game_state->frame_push_buffer, position.x, position.y, 10.0f, 10.0f, game_state->particles.colors[i].x, game_state->particles.colors[i].y, game_state->particles.colors[i].z);
+void UpdateParticles(ParticlePool *pool, f32 delta_time) {
+    // Padding lanes past count are integrated too, they are never read back
+    u32 lane_count = (pool->count + 7) & ~7u;
+    f32 *x = pool->x;
+    f32 *y = pool->y;
+    f32 *vx = pool->vx;
+    f32 *vy = pool->vy;
+    f32 *life = pool->life;
+
+    u32 i = 0;
+#if defined(__AVX__)
+    __m256 dt8 = _mm256_set1_ps(delta_time);
+    for (; i < lane_count; i += 8) {
+        _mm256_store_ps(x + i, _mm256_add_ps(_mm256_load_ps(x + i),
+                                             _mm256_mul_ps(_mm256_load_ps(vx + i), dt8)));
+        _mm256_store_ps(y + i, _mm256_add_ps(_mm256_load_ps(y + i),
+                                             _mm256_mul_ps(_mm256_load_ps(vy + i), dt8)));
+        _mm256_store_ps(life + i, _mm256_sub_ps(_mm256_load_ps(life + i), dt8));
+    }
+#elif VKH_MATH_SSE
+    __m128 dt4 = _mm_set1_ps(delta_time);
+    for (; i < lane_count; i += 4) {
+        _mm_store_ps(x + i, _mm_add_ps(_mm_load_ps(x + i),
+                                       _mm_mul_ps(_mm_load_ps(vx + i), dt4)));
+        _mm_store_ps(y + i, _mm_add_ps(_mm_load_ps(y + i),
+                                       _mm_mul_ps(_mm_load_ps(vy + i), dt4)));
+        _mm_store_ps(life + i, _mm_sub_ps(_mm_load_ps(life + i), dt4));
+    }
+#elif VKH_MATH_NEON
+    float32x4_t dt4 = vdupq_n_f32(delta_time);
+    for (; i < lane_count; i += 4) {
+        vst1q_f32(x + i, vaddq_f32(vld1q_f32(x + i), vmulq_f32(vld1q_f32(vx + i), dt4)));
+        vst1q_f32(y + i, vaddq_f32(vld1q_f32(y + i), vmulq_f32(vld1q_f32(vy + i), dt4)));
+        vst1q_f32(life + i, vsubq_f32(vld1q_f32(life + i), dt4));
+    }
+#endif
+    for (; i < lane_count; i++) {
+        x[i] += vx[i] * delta_time;
+        y[i] += vy[i] * delta_time;
+        life[i] -= delta_time;
+    }
+
+    // Swap-remove dead particles, order does not matter
+    i = 0;
+    while (i < pool->count) {
+        if (life[i] <= 0.0f) {
+            u32 last = --pool->count;
+            x[i] = x[last];
+            y[i] = y[last];
+            vx[i] = vx[last];
+            vy[i] = vy[last];
+            life[i] = life[last];
+            pool->color[i] = pool->color[last];
+        } else {
+            i++;
+        }
     }
 }
 
-void game_update_and_render(GameMemory *game_memory, GameInput *input) {
-    ASSERT(sizeof(GameState) <= game_memory->permanent_store_size);
-    GameState *game_state = (GameState *)(game_memory->permanent_store);
+// Positions are interpolated between the last two updates. Motion is
+// linear, so the previous position is x - vx * dt and needs no storage.
+void DrawParticles(GameState *game_state, PushBuffer *push_buffer, f32 alpha) {
+    ParticlePool *pool = &game_state->particles;
+    const f32 size = 10.0f;
+    f32 back = (alpha - 1.0f) * game_state->seconds_per_update;
+
+    for (u32 i = 0; i < pool->count; i++) {
+        u32 color = pool->color[i];
+        f32 r = (f32)(color & 0xFF) / 255.0f;
+        f32 g = (f32)((color >> 8) & 0xFF) / 255.0f;
+        f32 b = (f32)((color >> 16) & 0xFF) / 255.0f;
+
+        f32 x = pool->x[i] + pool->vx[i] * back;
+        f32 y = pool->y[i] + pool->vy[i] * back;
+        DrawRectangle(push_buffer, x - size / 2.0f, y - size / 2.0f, size,
+                      size, r, g, b);
+    }
+}
+
+vec2 ScreenToWorld(GameCamera *camera, vec2 screen) {
+    return {camera->position.x + screen.x / camera->zoom,
+            camera->position.y + screen.y / camera->zoom};
+}
+
+// Runs once per rendered frame on the latest input, so the view never lags
+// behind the cursor
+void UpdateCamera(GameCamera *camera, GameInput *input) {
+    vec2 mouse = {input->mouse_x * input->window_pixel_density,
+                  input->mouse_y * input->window_pixel_density};
+
+    if (input->mouse_wheel != 0.0f) {
+        // Keep the world point under the cursor where it is
+        vec2 anchor = ScreenToWorld(camera, mouse);
+        f32 zoom = camera->zoom * powf(1.1f, input->mouse_wheel);
+        camera->zoom = zoom < 0.1f ? 0.1f : (zoom > 10.0f ? 10.0f : zoom);
+        camera->position = {anchor.x - mouse.x / camera->zoom,
+                            anchor.y - mouse.y / camera->zoom};
+    }
+
+    if (input->digital_inputs[KEY_X].is_down) {
+        if (camera->dragging) {
+            camera->position.x -= (mouse.x - camera->drag_mouse.x) / camera->zoom;
+            camera->position.y -= (mouse.y - camera->drag_mouse.y) / camera->zoom;
+        }
+        camera->dragging = true;
+        camera->drag_mouse = mouse;
+    } else {
+        camera->dragging = false;
+    }
+}
 
-    MemoryArena transient_arena;
-    transient_arena.base = (uint8_t*) game_memory->transient_store;
-    transient_arena.size = game_memory->transient_store_size;
-    transient_arena.used = 0;
+GameState *GetGameState(GameMemory *game_memory) {
+    MemoryArena *permanent_arena = &game_memory->permanent_arena;
+    GameState *game_state = (GameState *)(permanent_arena->base);
+    if (game_memory->state_layout != GAME_STATE_LAYOUT) {
+        // First call, or reloaded code that can't read the old state.
+        // Everything after GameState was built from it, drop that too.
+        permanent_arena->used = 0;
+        arena_push(permanent_arena, sizeof(GameState));
+        *game_state = {};
+        game_memory->state_layout = GAME_STATE_LAYOUT;
+    }
 
     if (!game_state->is_initialised) {
         game_state->is_initialised = true;
-        game_memory->permanent_store_used += sizeof(GameState);
         game_state->number_of_rectangles = 0;
+        game_state->use_gpu_particles = false;
+        game_state->gpu_toggle_was_down = false;
+        game_state->camera = {};
+        game_state->camera.zoom = 1.0f;
+
+        game_state->background_layer = {STATIC_LAYER_BACKGROUND, true, 0};
+        game_state->grid_layer = {STATIC_LAYER_GRID, true, 0};
+        game_state->background_size = {};
+        game_state->grid_stride = 0;
+
+        InitParticlePool(&game_state->particles, permanent_arena, MAX_PARTICLES);
+
+        ParticleEmitter *emitter = &game_state->mouse_emitter;
+        emitter->spawn_rate = 300000.0f;
+        emitter->spawn_accumulator = 0.0f;
+        emitter->lifetime = 2.0f;
+        emitter->speed = 1000.0f;
     }
 
-    u32 push_buffer_size = 1024 * 1024 * 256;
-    game_state->frame_push_buffer.arena.base = arena_push(&transient_arena, push_buffer_size);
-    game_state->frame_push_buffer.arena.size = push_buffer_size;
-    game_state->frame_push_buffer.arena.used = 0;
-    game_state->frame_push_buffer.number_of_entries = 0;
+    return game_state;
+}
+
+void game_update(GameMemory *game_memory, GameInput *input) {
+    GameState *game_state = GetGameState(game_memory);
+
+    f32 delta_time = (f32)input->seconds_per_update;
+    game_state->seconds_per_update = delta_time;
 
     if (input->digital_inputs[D_LEFT].is_down) {
         if (game_state->number_of_rectangles > 0) {
             game_state->number_of_rectangles--;
+            game_state->grid_layer.dirty = true;
         }
     }
 
     if (input->digital_inputs[D_RIGHT].is_down) {
         if (game_state->number_of_rectangles < 2000) {
             game_state->number_of_rectangles++;
+            game_state->grid_layer.dirty = true;
         }
     }
 
-if (1) {
-    if (input->digital_inputs[KEY_A].is_down) {
-        SpawnParticles(game_state, {input->mouse_x, input->mouse_y}, input->window_pixel_density);
+    bool gpu_toggle_down = input->digital_inputs[TOGGLE_GPU_PARTICLES].is_down;
+    if (gpu_toggle_down && !game_state->gpu_toggle_was_down) {
+        game_state->use_gpu_particles = !game_state->use_gpu_particles;
+    }
+    game_state->gpu_toggle_was_down = gpu_toggle_down;
+
+    // Particles live in the world, they stay put when the camera moves
+    ParticleEmitter *emitter = &game_state->mouse_emitter;
+    emitter->position = ScreenToWorld(
+        &game_state->camera, {input->mouse_x * input->window_pixel_density,
+                              input->mouse_y * input->window_pixel_density});
+
+    if (game_state->use_gpu_particles) {
+        // The GPU simulation steps once per rendered frame, by everything
+        // simulated since the last one
+        game_state->gpu_particle_pending_time += delta_time;
+        if (input->digital_inputs[KEY_A].is_down) {
+            game_state->gpu_particle_pending_spawns +=
+                ConsumeSpawnCount(emitter, delta_time);
+        }
+    } else if (input->digital_inputs[KEY_A].is_down) {
+        EmitParticles(&game_state->particles, emitter, delta_time);
     }
 
+    UpdateParticles(&game_state->particles, delta_time);
+}
+
+void game_render(GameMemory *game_memory, GameInput *input,
+                 PushBuffer *push_buffer, f32 alpha) {
+    GameState *game_state = GetGameState(game_memory);
+
+    GameCamera *camera = &game_state->camera;
+    UpdateCamera(camera, input);
+    SetCamera(push_buffer, camera->position.x, camera->position.y,
+              camera->zoom);
+    SetLayerScreenSpace(push_buffer, LAYER_BACKGROUND);
+    SetLayerScreenSpace(push_buffer, LAYER_CURSOR);
+
     {
         float width = input->window_width * input->window_pixel_density;
         float height = input->window_height * input->window_pixel_density;
@@ -100,16 +289,35 @@ if (1) {
         float r = 0.1f;
         float g = 0.2f;
         float b = 0.5f;
-        float a = 1.0f;
 
-        DrawRectangle(&game_state->frame_push_buffer, x, y, width, height, r, g, b);
+        StaticLayer *layer = &game_state->background_layer;
+        if (game_state->background_size.x != width ||
+            game_state->background_size.y != height) {
+            game_state->background_size = {width, height};
+            layer->dirty = true;
+        }
+
+        SetLayer(push_buffer, LAYER_BACKGROUND);
+        if (BeginStaticLayer(push_buffer, layer)) {
+            DrawRectangle(push_buffer, x, y, width, height, r, g, b);
+        }
+        EndStaticLayer(push_buffer, layer);
     }
-}
 
     {
+        SetLayer(push_buffer, LAYER_WORLD);
+
         u32 stride = (input->window_width * input->window_pixel_density) / 50;
 
-        for (u32 i = 0; i < game_state->number_of_rectangles; i++){
+        StaticLayer *layer = &game_state->grid_layer;
+        if (game_state->grid_stride != stride) {
+            game_state->grid_stride = stride;
+            layer->dirty = true;
+        }
+
+        // Resident on the GPU, only rebuilt when the count or stride change
+        bool dirty = BeginStaticLayer(push_buffer, layer);
+        for (u32 i = 0; dirty && i < game_state->number_of_rectangles; i++){
 
             float width = 50.0f;
             float height = 50.0f;
@@ -118,28 +326,41 @@ if (1) {
             float r = 0.0f;
             float g = 1.0f * (i % 2);
             float b = 1.0f * (1.0f - (i % 2));
-            float a = 1.0f;
 
-            DrawRectangle(&game_state->frame_push_buffer, x, y, width, height, r, g, b);
+            // Mixed sprites still come out as one draw
+            SpriteId sprite = (i % 3 == 2) ? SPRITE_HEART : SPRITE_TILE;
+            DrawSprite(push_buffer, sprite, x, y, width, height, r, g, b);
 
         }
+        EndStaticLayer(push_buffer, layer);
 
     }
 
     {
-        float width = 20.0f;
-        float height = 20.0f;
-        float x = input->mouse_x * input->window_pixel_density - width / 2.0f;
-        float y = input->mouse_y * input->window_pixel_density - height / 2.0f;
+        // Latest mouse position, not the last update's, so the cursor
+        // doesn't lag. Pushed before the particles, the layer keeps it on top.
+        float x = input->mouse_x * input->window_pixel_density;
+        float y = input->mouse_y * input->window_pixel_density;
         float r = 1.0f;
         float g = 0.0f;
         float b = 0.0f;
-        float a = 1.0f;
 
-        DrawRectangle(&game_state->frame_push_buffer, x, y, width, height, r, g, b);
+        SetLayer(push_buffer, LAYER_CURSOR);
+        DrawTriangle(push_buffer, x, y, x, y + 24.0f, x + 16.0f, y + 16.0f, r,
+                     g, b);
     }
 
+    SetLayer(push_buffer, LAYER_PARTICLES);
+
+    DrawParticles(game_state, push_buffer, alpha);
 
-    UpdateParticles(game_state, input->seconds_passed_since_last_frame);
-    DrawParticles(game_state);
+    if (game_state->use_gpu_particles) {
+        ParticleEmitter *emitter = &game_state->mouse_emitter;
+        DrawGPUParticles(push_buffer, emitter->position.x, emitter->position.y,
+                         game_state->gpu_particle_pending_time,
+                         game_state->gpu_particle_pending_spawns,
+                         emitter->lifetime, emitter->speed);
+        game_state->gpu_particle_pending_time = 0.0f;
+        game_state->gpu_particle_pending_spawns = 0;
+    }
 }
@@ -39,54 +39,126 @@ enum key {
     LEFT_STICK_BUTTON,
     RIGHT_STICK_BUTTON,
 
+    // Keyboard only, no gamepad equivalent
+    TOGGLE_GPU_PARTICLES,
+
     KEYS_SIZE,
 };
 
 struct GameInput {
-    double seconds_passed_since_last_frame;
+    double seconds_per_update;  // fixed simulation step
     key_state digital_inputs[KEYS_SIZE];
 
     f32 mouse_x;
     f32 mouse_y;
+    f32 mouse_wheel;  // scrolled since the last rendered frame, up > 0
 
     f32 window_pixel_density;
     i32 window_width;
     i32 window_height;
 };
 
+// NOTE: The arena is reserved by the platform and commits pages as it
+// grows. GameState sits at its start. Per-frame temporaries go on the
+// thread's scratch arenas, the frame itself is built into the push buffer.
 struct GameMemory {
-    u64 permanent_store_size;
-    u64 permanent_store_used;
-    void *permanent_store;
+    MemoryArena permanent_arena;
+    u64 state_layout;  // GAME_STATE_LAYOUT of the code that built the state
+};
+
+// Pan by dragging with the right mouse button (KEY_X), zoom with the wheel
+// around the cursor. Positions are in pixels, see RenderCamera.
+struct GameCamera {
+    vec2 position;  // world position at the top-left of the screen
+    f32 zoom;
+    bool dragging;
+    vec2 drag_mouse;  // screen position of the cursor last frame
+};
 
-    u64 transient_store_size;
-    u64 transient_store_used;
-    void *transient_store;
+struct ParticleEmitter {
+    vec2 position;
+    f32 spawn_rate;  // particles per second
+    f32 spawn_accumulator;
+    f32 lifetime;  // seconds
+    f32 speed;     // pixels per second
 };
 
-struct GameCamera {};
+// Structure of arrays with a fixed capacity, carved out of the permanent
+// store. Every array is 32 byte aligned and the capacity is a multiple of 8,
+// so the update loop runs whole SIMD lanes without a scalar tail.
+struct ParticlePool {
+    u32 capacity;
+    u32 count;
+    f32 *x;
+    f32 *y;
+    f32 *vx;
+    f32 *vy;
+    f32 *life;
+    u32 *color;  // RGBA8, R in the lowest byte
+};
+
+// Push buffer layers, drawn back to front
+enum GameLayer {
+    LAYER_BACKGROUND,
+    LAYER_WORLD,
+    LAYER_PARTICLES,
+    LAYER_CURSOR,
+};
 
-struct Particles {
-    u32 num_of_particles;
-    vec2* positions;
-    vec2* velocities;
-    vec3* colors;
+// Renderer slots of the game's retained layers, < STATIC_LAYER_MAX
+enum GameStaticLayer {
+    STATIC_LAYER_BACKGROUND,
+    STATIC_LAYER_GRID,
 };
 
 struct GameState {
     bool is_initialised = false;
-    PushBuffer frame_push_buffer;
     u64 number_of_rectangles = 0;
-    Particles particles;
+    GameCamera camera;
+
+    // Only redrawn when what they were built from changes
+    StaticLayer background_layer;
+    StaticLayer grid_layer;
+    vec2 background_size;
+    u32 grid_stride;
+    ParticleEmitter mouse_emitter;
+    ParticlePool particles;
+
+    // G switches new particles between the CPU pool and the GPU simulation
+    bool use_gpu_particles;
+    bool gpu_toggle_was_down;
+
+    // Simulated time and spawns not yet handed to the GPU simulation, which
+    // steps once per rendered frame
+    f32 gpu_particle_pending_time;
+    u32 gpu_particle_pending_spawns;
+
+    f32 seconds_per_update;  // of the last update, used to interpolate
 };
 
+// NOTE: State survives a reload only if the new code lays it out the same
+// way, otherwise it's rebuilt from scratch. The size catches most changes,
+// bump GAME_STATE_VERSION for the ones it doesn't, like reordered fields or
+// a different layout of the particle arrays.
+const u32 GAME_STATE_VERSION = 1;
+const u64 GAME_STATE_LAYOUT =
+    ((u64)GAME_STATE_VERSION << 32) | (u64)sizeof(GameState);
+
+// NOTE: game_update advances the simulation by input->seconds_per_update
+// and runs zero or more times per rendered frame. game_render only draws,
+// alpha in [0, 1] is how far the current time is between the last two
+// updates. push_buffer is owned by the platform and empty on entry, the
+// render thread consumes it once game_render returns.
 typedef void (*game_update_t)(GameMemory *state, GameInput *input);
+typedef void (*game_render_t)(GameMemory *state, GameInput *input,
+                              PushBuffer *push_buffer, f32 alpha);
 
 #ifdef _WIN64
-extern "C"
-    __declspec(dllexport)
+#define GAME_API extern "C" __declspec(dllexport)
 #else
-extern "C"
+#define GAME_API extern "C"
 #endif
-    void
-    game_update_and_render(GameMemory *state, GameInput *input);
+
+GAME_API void game_update(GameMemory *state, GameInput *input);
+GAME_API void game_render(GameMemory *state, GameInput *input,
+                          PushBuffer *push_buffer, f32 alpha);
@@ -0,0 +1,320 @@
+#include "vkh_gpu_memory.h"
+
+static uint32_t gpu_order_for_size(VkDeviceSize size) {
+    uint32_t order = 0;
+    while ((GPU_MIN_ALLOCATION << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+static uint8_t gpu_max_u8(uint8_t a, uint8_t b) { return a > b ? a : b; }
+
+// Recomputes the parents of node, merging buddies that are both free
+static void gpu_block_update_parents(GpuMemoryBlock* block, uint32_t node,
+                                     uint32_t order) {
+    while (node > 1) {
+        node >>= 1;
+        order++;
+
+        uint8_t left = block->longest[node * 2];
+        uint8_t right = block->longest[node * 2 + 1];
+        if (left == order && right == order) {
+            block->longest[node] = (uint8_t)(order + 1);
+        } else {
+            block->longest[node] = gpu_max_u8(left, right);
+        }
+    }
+}
+
+static bool gpu_block_alloc(GpuMemoryBlock* block, uint32_t order,
+                            VkDeviceSize* offset) {
+    if (block->longest[1] < order + 1) {
+        return false;
+    }
+
+    uint32_t node = 1;
+    uint32_t node_order = block->max_order;
+    while (node_order != order) {
+        // Left first keeps allocations packed towards the start
+        node = block->longest[node * 2] >= order + 1 ? node * 2 : node * 2 + 1;
+        node_order--;
+    }
+
+    block->longest[node] = 0;
+    gpu_block_update_parents(block, node, order);
+
+    uint32_t depth = block->max_order - order;
+    *offset = (VkDeviceSize)(node - (1u << depth)) * (GPU_MIN_ALLOCATION << order);
+    block->allocation_count++;
+    return true;
+}
+
+static void gpu_block_free(GpuMemoryBlock* block, VkDeviceSize offset,
+                           uint32_t order) {
+    uint32_t depth = block->max_order - order;
+    uint32_t node =
+        (1u << depth) + (uint32_t)(offset / (GPU_MIN_ALLOCATION << order));
+
+    assert(block->longest[node] == 0);
+    block->longest[node] = (uint8_t)(order + 1);
+    gpu_block_update_parents(block, node, order);
+    block->allocation_count--;
+}
+
+static bool gpu_allocate_device_memory(GpuAllocator* allocator,
+                                       uint32_t memory_type, VkDeviceSize size,
+                                       GpuMemoryBlock* block) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memory_type;
+
+    VkResult res = vkAllocateMemory(allocator->device, &allocInfo, nullptr,
+                                    &block->memory);
+    if (res != VK_SUCCESS) {
+        return false;
+    }
+
+    block->size = size;
+    block->mapped = 0;
+    block->allocation_count = 0;
+
+    // Host visible blocks stay mapped for their whole life
+    VkMemoryPropertyFlags flags =
+        allocator->memory_properties.memoryTypes[memory_type].propertyFlags;
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(allocator->device, block->memory, 0, VK_WHOLE_SIZE, 0,
+                    &block->mapped);
+    }
+
+    return true;
+}
+
+void gpu_allocator_init(GpuAllocator* allocator, VkPhysicalDevice physical_device,
+                        VkDevice device, MemoryArena* arena) {
+    *allocator = {};
+    allocator->device = device;
+    allocator->arena = arena;
+    vkGetPhysicalDeviceMemoryProperties(physical_device,
+                                        &allocator->memory_properties);
+}
+
+void gpu_allocator_shutdown(GpuAllocator* allocator) {
+    for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+        for (uint32_t kind = 0; kind < GPU_RESOURCE_KIND_MAX; kind++) {
+            GpuMemoryPool* pool = &allocator->pools[type][kind];
+            for (uint32_t i = 0; i < pool->block_count; i++) {
+                if (pool->blocks[i].memory) {
+                    vkFreeMemory(allocator->device, pool->blocks[i].memory, 0);
+                    pool->blocks[i].memory = VK_NULL_HANDLE;
+                }
+            }
+            pool->block_count = 0;
+        }
+    }
+}
+
+static uint32_t gpu_find_memory_type(GpuAllocator* allocator,
+                                     uint32_t type_bits,
+                                     VkMemoryPropertyFlags properties) {
+    for (uint32_t i = 0; i < allocator->memory_properties.memoryTypeCount;
+         i++) {
+        if ((type_bits & (1u << i)) &&
+            (allocator->memory_properties.memoryTypes[i].propertyFlags &
+             properties) == properties) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static GpuMemoryBlock* gpu_pool_free_slot(GpuMemoryPool* pool,
+                                          uint32_t* index) {
+    for (uint32_t i = 0; i < pool->block_count; i++) {
+        if (pool->blocks[i].memory == VK_NULL_HANDLE) {
+            *index = i;
+            return &pool->blocks[i];
+        }
+    }
+    if (pool->block_count == GPU_MAX_BLOCKS_PER_POOL) {
+        return 0;
+    }
+    *index = pool->block_count++;
+    return &pool->blocks[*index];
+}
+
+bool gpu_alloc(GpuAllocator* allocator, VkMemoryRequirements requirements,
+               VkMemoryPropertyFlags properties, GpuResourceKind kind,
+               GpuAllocation* allocation) {
+    *allocation = {};
+
+    uint32_t memory_type = gpu_find_memory_type(
+        allocator, requirements.memoryTypeBits, properties);
+    if (memory_type == UINT32_MAX) {
+        return false;
+    }
+
+    GpuMemoryPool* pool = &allocator->pools[memory_type][kind];
+
+    // Buddy blocks are aligned to their own size, so rounding up to the
+    // alignment is all it takes to satisfy it
+    VkDeviceSize rounded = requirements.size > requirements.alignment
+                               ? requirements.size
+                               : requirements.alignment;
+    uint32_t order = gpu_order_for_size(rounded);
+    uint32_t block_order = gpu_order_for_size(GPU_BLOCK_SIZE);
+
+    uint32_t block_index = 0;
+    GpuMemoryBlock* block = 0;
+    VkDeviceSize offset = 0;
+
+    if (order >= block_order) {
+        // Too big to share a block, give it its own allocation
+        block = gpu_pool_free_slot(pool, &block_index);
+        if (!block || !gpu_allocate_device_memory(allocator, memory_type,
+                                                  requirements.size, block)) {
+            return false;
+        }
+        block->dedicated = true;
+        block->longest = 0;
+        block->max_order = 0;
+        block->allocation_count = 1;
+        order = 0xFF;
+    } else {
+        for (uint32_t i = 0; i < pool->block_count; i++) {
+            GpuMemoryBlock* candidate = &pool->blocks[i];
+            if (candidate->memory && !candidate->dedicated &&
+                gpu_block_alloc(candidate, order, &offset)) {
+                block = candidate;
+                block_index = i;
+                break;
+            }
+        }
+
+        if (!block) {
+            block = gpu_pool_free_slot(pool, &block_index);
+            if (!block) {
+                return false;
+            }
+
+            if (!gpu_allocate_device_memory(allocator, memory_type,
+                                            GPU_BLOCK_SIZE, block)) {
+                return false;
+            }
+            block->dedicated = false;
+            block->max_order = block_order;
+
+            uint32_t node_count = 2u << block_order;
+            block->longest = arena_push(allocator->arena, node_count);
+            for (uint32_t node = 1; node < node_count; node++) {
+                uint32_t depth = 31 - __builtin_clz(node);
+                block->longest[node] = (uint8_t)(block_order - depth + 1);
+            }
+
+            bool ok = gpu_block_alloc(block, order, &offset);
+            assert(ok);
+        }
+    }
+
+    allocation->memory = block->memory;
+    allocation->offset = offset;
+    allocation->size = requirements.size;
+    allocation->mapped =
+        block->mapped ? (uint8_t*)block->mapped + offset : 0;
+    allocation->memory_type = (uint8_t)memory_type;
+    allocation->kind = (uint8_t)kind;
+    allocation->block = (uint8_t)block_index;
+    allocation->order = (uint8_t)order;
+
+    allocator->requested_bytes += requirements.size;
+    return true;
+}
+
+void gpu_free(GpuAllocator* allocator, GpuAllocation* allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    GpuMemoryPool* pool =
+        &allocator->pools[allocation->memory_type][allocation->kind];
+    GpuMemoryBlock* block = &pool->blocks[allocation->block];
+    assert(block->memory == allocation->memory);
+
+    if (block->dedicated) {
+        vkFreeMemory(allocator->device, block->memory, 0);
+        block->memory = VK_NULL_HANDLE;
+        block->mapped = 0;
+        block->allocation_count = 0;
+    } else {
+        // NOTE: Empty buddy blocks are kept, the next burst of loads
+        // would only allocate them again
+        gpu_block_free(block, allocation->offset, allocation->order);
+    }
+
+    allocator->requested_bytes -= allocation->size;
+    *allocation = {};
+}
+
+// Allocated nodes read 0 and their subtrees are stale, so only descend
+// into nodes that are split and partly free
+static VkDeviceSize gpu_block_free_bytes(GpuMemoryBlock* block, uint32_t node,
+                                         uint32_t order) {
+    uint8_t longest = block->longest[node];
+    if (longest == order + 1) {
+        return GPU_MIN_ALLOCATION << order;
+    }
+    if (longest == 0) {
+        return 0;
+    }
+    return gpu_block_free_bytes(block, node * 2, order - 1) +
+           gpu_block_free_bytes(block, node * 2 + 1, order - 1);
+}
+
+GpuAllocatorStats gpu_allocator_stats(GpuAllocator* allocator) {
+    GpuAllocatorStats stats = {};
+    VkDeviceSize free_bytes = 0;
+    VkDeviceSize largest_free_sum = 0;
+
+    for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+        for (uint32_t kind = 0; kind < GPU_RESOURCE_KIND_MAX; kind++) {
+            GpuMemoryPool* pool = &allocator->pools[type][kind];
+            for (uint32_t i = 0; i < pool->block_count; i++) {
+                GpuMemoryBlock* block = &pool->blocks[i];
+                if (!block->memory) {
+                    continue;
+                }
+
+                stats.reserved_bytes += block->size;
+                stats.allocation_count += block->allocation_count;
+
+                if (block->dedicated) {
+                    stats.dedicated_count++;
+                    stats.used_bytes += block->size;
+                    continue;
+                }
+
+                stats.block_count++;
+
+                VkDeviceSize block_free =
+                    gpu_block_free_bytes(block, 1, block->max_order);
+                free_bytes += block_free;
+                stats.used_bytes += block->size - block_free;
+
+                if (block->longest[1]) {
+                    VkDeviceSize largest = GPU_MIN_ALLOCATION
+                                           << (block->longest[1] - 1);
+                    largest_free_sum += largest;
+                    if (largest > stats.largest_free_block) {
+                        stats.largest_free_block = largest;
+                    }
+                }
+            }
+        }
+    }
+
+    stats.requested_bytes = allocator->requested_bytes;
+    stats.fragmentation =
+        free_bytes ? 1.0f - (float)largest_free_sum / (float)free_bytes : 0.0f;
+    return stats;
+}
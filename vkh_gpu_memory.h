@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vkh_memory.h"
+
+// Linear (buffers, linear images) and optimal-tiling images never share a
+// block, so bufferImageGranularity can't put them on the same page
+enum GpuResourceKind {
+    GPU_RESOURCE_LINEAR,
+    GPU_RESOURCE_OPTIMAL,
+
+    GPU_RESOURCE_KIND_MAX,
+};
+
+struct GpuAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;  // as requested
+    void* mapped;       // null unless the memory type is host visible
+
+    uint8_t memory_type;
+    uint8_t kind;
+    uint8_t block;
+    uint8_t order;  // buddy order, 0xFF for dedicated blocks
+};
+
+// Buddy allocator over one VkDeviceMemory. longest[] is a heap ordered
+// binary tree (root at 1) holding 1 + the order of the largest free block
+// in each subtree, 0 when the subtree is full.
+struct GpuMemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void* mapped;
+    uint8_t* longest;
+    uint32_t max_order;  // size == GPU_MIN_ALLOCATION << max_order
+    uint32_t allocation_count;
+    bool dedicated;
+};
+
+const VkDeviceSize GPU_MIN_ALLOCATION = 256;
+const VkDeviceSize GPU_BLOCK_SIZE = 1024 * 1024 * 64;  // 64 MB
+const uint32_t GPU_MAX_BLOCKS_PER_POOL = 32;
+
+struct GpuMemoryPool {
+    GpuMemoryBlock blocks[GPU_MAX_BLOCKS_PER_POOL];
+    uint32_t block_count;
+};
+
+struct GpuAllocatorStats {
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    uint32_t allocation_count;
+    VkDeviceSize reserved_bytes;   // device memory held by the allocator
+    VkDeviceSize used_bytes;       // handed out, including buddy rounding
+    VkDeviceSize requested_bytes;  // what callers asked for
+    VkDeviceSize largest_free_block;
+    // 1 - (sum of each block's largest free run) / free bytes, 0 is best
+    float fragmentation;
+};
+
+// NOTE: Not thread safe, only the thread that owns the VulkanContext
+// allocates from it, which is the render thread after init
+struct GpuAllocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    MemoryArena* arena;  // buddy trees, never given back
+    GpuMemoryPool pools[VK_MAX_MEMORY_TYPES][GPU_RESOURCE_KIND_MAX];
+    VkDeviceSize requested_bytes;
+};
+
+void gpu_allocator_init(GpuAllocator* allocator, VkPhysicalDevice physical_device,
+                        VkDevice device, MemoryArena* arena);
+void gpu_allocator_shutdown(GpuAllocator* allocator);
+
+// Picks the first memory type allowed by requirements that has all of
+// properties. Returns false when there is none or the device is out of memory.
+bool gpu_alloc(GpuAllocator* allocator, VkMemoryRequirements requirements,
+               VkMemoryPropertyFlags properties, GpuResourceKind kind,
+               GpuAllocation* allocation);
+void gpu_free(GpuAllocator* allocator, GpuAllocation* allocation);
+
+GpuAllocatorStats gpu_allocator_stats(GpuAllocator* allocator);
@@ -0,0 +1,224 @@
+// Compares the mapped BMP decoder, with every row kernel this CPU has,
+// against the old per-byte fgetc loader on large images. Every kernel must
+// produce the scalar kernel's pixels exactly, also for widths that end in
+// a partial vector. Exits non-zero on a mismatch.
+
+#include <assert.h>
+#define ASSERT(expr) assert(expr)
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "vkh_memory.cpp"
+#include "image.cpp"
+
+static uint32_t GLOBAL_rng_state = 0x2545F491;
+
+static uint8_t random_byte() {
+    uint32_t x = GLOBAL_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    GLOBAL_rng_state = x;
+    return (uint8_t)(x >> 24);
+}
+
+static void putBenchU16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void putBenchU32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+// Random pixels behind a bottom-up BMP header. 32 bit files with alpha get
+// a V3 header with BGRA masks, the others a plain BITMAPINFOHEADER.
+static size_t makeBMP(MemoryArena *arena, uint32_t width, uint32_t height,
+                      uint32_t bytes_per_pixel, bool has_alpha,
+                      uint8_t **file) {
+    uint32_t header_size = has_alpha ? 56 : 40;
+    uint32_t pixel_offset = 14 + header_size;
+    uint64_t row_stride = ((uint64_t)width * bytes_per_pixel + 3) & ~3ull;
+    size_t size = pixel_offset + row_stride * height;
+
+    uint8_t *bmp = arena_push(arena, size);
+    memset(bmp, 0, pixel_offset);
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    putBenchU32(&bmp[0x02], (uint32_t)size);
+    putBenchU32(&bmp[0x0A], pixel_offset);
+    putBenchU32(&bmp[0x0E], header_size);
+    putBenchU32(&bmp[0x12], width);
+    putBenchU32(&bmp[0x16], height);
+    putBenchU16(&bmp[0x1A], 1);
+    putBenchU16(&bmp[0x1C], (uint16_t)(bytes_per_pixel * 8));
+    if (has_alpha) {
+        putBenchU32(&bmp[0x1E], BMP_BI_BITFIELDS);
+        putBenchU32(&bmp[0x36], 0x00FF0000);
+        putBenchU32(&bmp[0x3A], 0x0000FF00);
+        putBenchU32(&bmp[0x3E], 0x000000FF);
+        putBenchU32(&bmp[0x42], 0xFF000000);
+    }
+
+    for (size_t i = pixel_offset; i < size; i++) {
+        bmp[i] = random_byte();
+    }
+
+    *file = bmp;
+    return size;
+}
+
+// Decodes with every supported kernel and compares against scalar
+static bool checkKernels(const uint8_t *file, size_t size, MemoryArena *arena) {
+    BMPInfo info;
+    if (!parseBMP(file, size, &info)) {
+        return false;
+    }
+
+    TempArenaScope scope(arena);
+    size_t pixels_size = (size_t)info.width * info.height * sizeof(uint32_t);
+    uint32_t *expected = (uint32_t *)arena_push(arena, pixels_size);
+    uint32_t *actual = (uint32_t *)arena_push(arena, pixels_size);
+    decodeBMPRows(file, &info, expected, IMAGE_KERNEL_SCALAR);
+
+    for (uint32_t kernel = 1; kernel <= imageKernel(); kernel++) {
+        memset(actual, 0, pixels_size);
+        decodeBMPRows(file, &info, actual, (ImageKernel)kernel);
+        if (memcmp(expected, actual, pixels_size) != 0) {
+            fprintf(stderr, "%s differs from scalar: %u x %u, %u bpp%s\n",
+                    IMAGE_KERNEL_NAMES[kernel], info.width, info.height,
+                    info.bytes_per_pixel * 8, info.has_alpha ? ", alpha" : "");
+            return false;
+        }
+    }
+    return true;
+}
+
+// The loader before the mapped decoder: three fgetc calls per pixel, 24 bit
+// only, padding and orientation ignored. Kept here to measure against.
+static bool loadBMPFgetc(const char *filename, uint32_t *dst) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned char header[54];
+    if (fread(header, 1, 54, file) != 54) {
+        fclose(file);
+        return false;
+    }
+
+    int data_pos = (int)getU32(&header[0x0A]);
+    int width = (int)getU32(&header[0x12]);
+    int height = (int)getU32(&header[0x16]);
+    fseek(file, data_pos ? data_pos : 54, SEEK_SET);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t b = fgetc(file);
+            uint8_t g = fgetc(file);
+            uint8_t r = fgetc(file);
+            dst[x + y * width] = (255u << 24) | (b << 16) | (g << 8) | r;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+// Best of a few runs, the file is in the page cache after the first
+static double benchLoad(const char *filename, ImageKernel kernel,
+                        uint32_t *dst) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        MappedFile file = mapFile(filename);
+        BMPInfo info;
+        bool ok = file.data && parseBMP(file.data, file.size, &info);
+        assert(ok);
+        (void)ok;
+        decodeBMPRows(file.data, &info, dst, kernel);
+        unmapFile(&file);
+        double ms = millisecondsSince(start);
+        best = ms < best ? ms : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    const uint32_t SIZE = 4096;
+    const char *filename = argc > 1 ? argv[1] : "vkh_image_bench.bmp";
+
+    MemoryArena arena;
+    bool reserved = arena_reserve(&arena, 1024ull * 1024 * 1024, 0);
+    assert(reserved);
+    (void)reserved;
+
+    printf("row kernels on this CPU: up to %s\n",
+           IMAGE_KERNEL_NAMES[imageKernel()]);
+
+    // Every width up to a few vectors, so each tail length is covered
+    bool ok = true;
+    for (uint32_t width = 1; ok && width <= 70; width++) {
+        TempArenaScope scope(&arena);
+        uint8_t *file;
+        size_t size = makeBMP(&arena, width, 3, 3, false, &file);
+        ok &= checkKernels(file, size, &arena);
+        size = makeBMP(&arena, width, 3, 4, false, &file);
+        ok &= checkKernels(file, size, &arena);
+        size = makeBMP(&arena, width, 3, 4, true, &file);
+        ok &= checkKernels(file, size, &arena);
+    }
+
+    uint8_t *file;
+    size_t size = makeBMP(&arena, SIZE, SIZE, 3, false, &file);
+    ok &= checkKernels(file, size, &arena);
+
+    FILE *out = fopen(filename, "wb");
+    if (!out || fwrite(file, 1, size, out) != size) {
+        fprintf(stderr, "Error: could not write %s\n", filename);
+        return 1;
+    }
+    fclose(out);
+
+    uint32_t *pixels = (uint32_t *)arena_push_aligned(
+        &arena, (size_t)SIZE * SIZE * sizeof(uint32_t), 32);
+    double mb = (double)size / (1024.0 * 1024.0);
+
+    double fgetc_ms = 1e30;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::steady_clock::now();
+        bool loaded = loadBMPFgetc(filename, pixels);
+        assert(loaded);
+        (void)loaded;
+        double ms = millisecondsSince(start);
+        fgetc_ms = ms < fgetc_ms ? ms : fgetc_ms;
+    }
+    printf("%u x %u, 24 bpp, %.0f MB\n", SIZE, SIZE, mb);
+    printf("  fgetc:          %8.2f ms %8.0f MB/s\n", fgetc_ms,
+           mb * 1000.0 / fgetc_ms);
+
+    for (uint32_t kernel = 0; kernel <= imageKernel(); kernel++) {
+        double ms = benchLoad(filename, (ImageKernel)kernel, pixels);
+        printf("  mapped, %-7s %8.2f ms %8.0f MB/s, %.1fx\n",
+               IMAGE_KERNEL_NAMES[kernel], ms, mb * 1000.0 / ms,
+               fgetc_ms / ms);
+    }
+
+    remove(filename);
+
+    printf("kernels match scalar: %s\n", ok ? "yes" : "NO");
+    arena_release(&arena);
+    return ok ? 0 : 1;
+}
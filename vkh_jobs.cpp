@@ -0,0 +1,183 @@
+#include "vkh_jobs.h"
+
+const uint32_t JOB_QUEUE_CAPACITY = 1024;
+
+struct JobWorkerStartup {
+    JobSystem* js;
+    uint32_t thread_index;
+};
+
+static thread_local uint32_t job_thread_index = 0;
+
+static bool job_queue_push(JobQueue* queue, Job job) {
+    bool pushed = false;
+
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->tail - queue->head < queue->capacity) {
+        queue->jobs[queue->tail & (queue->capacity - 1)] = job;
+        queue->tail++;
+        pushed = true;
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+
+    return pushed;
+}
+
+static bool job_queue_pop(JobQueue* queue, Job* job) {
+    bool popped = false;
+
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->tail != queue->head) {
+        queue->tail--;
+        *job = queue->jobs[queue->tail & (queue->capacity - 1)];
+        popped = true;
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+
+    return popped;
+}
+
+static bool job_queue_steal(JobQueue* queue, Job* job) {
+    bool stolen = false;
+
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->tail != queue->head) {
+        *job = queue->jobs[queue->head & (queue->capacity - 1)];
+        queue->head++;
+        stolen = true;
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+
+    return stolen;
+}
+
+static void job_run(Job* job) {
+    job->func(job->data);
+    SDL_AddAtomicInt(&job->counter->remaining, -1);
+}
+
+// Own queue first (newest job, still warm in cache), then steal the oldest
+// job from the other threads, starting at our right-hand neighbour.
+static bool job_try_run_one(JobSystem* js) {
+    uint32_t queue_count = js->worker_count + 1;
+    uint32_t self = job_thread_index;
+
+    Job job;
+    if (job_queue_pop(&js->queues[self], &job)) {
+        job_run(&job);
+        return true;
+    }
+
+    for (uint32_t i = 1; i < queue_count; i++) {
+        uint32_t victim = (self + i) % queue_count;
+        if (job_queue_steal(&js->queues[victim], &job)) {
+            job_run(&job);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int job_worker_main(void* data) {
+    JobWorkerStartup* startup = (JobWorkerStartup*)data;
+    JobSystem* js = startup->js;
+    job_thread_index = startup->thread_index;
+
+    while (SDL_GetAtomicInt(&js->running)) {
+        if (!job_try_run_one(js)) {
+            SDL_WaitSemaphoreTimeout(js->wake, 10);
+        }
+    }
+
+    return 0;
+}
+
+void job_system_init(JobSystem* js, MemoryArena* arena, uint32_t worker_count) {
+    js->worker_count = worker_count;
+    SDL_SetAtomicInt(&js->running, 1);
+    job_thread_index = 0;
+
+    uint32_t queue_count = worker_count + 1;
+    js->queues = (JobQueue*)arena_push(arena, sizeof(JobQueue) * queue_count);
+    for (uint32_t i = 0; i < queue_count; i++) {
+        js->queues[i].lock = 0;
+        js->queues[i].jobs =
+            (Job*)arena_push(arena, sizeof(Job) * JOB_QUEUE_CAPACITY);
+        js->queues[i].capacity = JOB_QUEUE_CAPACITY;
+        js->queues[i].head = 0;
+        js->queues[i].tail = 0;
+    }
+
+    if (worker_count == 0) {
+        js->threads = 0;
+        js->wake = 0;
+        return;
+    }
+
+    js->wake = SDL_CreateSemaphore(0);
+    js->threads =
+        (SDL_Thread**)arena_push(arena, sizeof(SDL_Thread*) * worker_count);
+
+    JobWorkerStartup* startups = (JobWorkerStartup*)arena_push(
+        arena, sizeof(JobWorkerStartup) * worker_count);
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        startups[i].js = js;
+        startups[i].thread_index = i + 1;
+        js->threads[i] =
+            SDL_CreateThread(job_worker_main, "vkh_job_worker", &startups[i]);
+        assert(js->threads[i]);
+    }
+}
+
+void job_system_shutdown(JobSystem* js) {
+    if (js->worker_count == 0) {
+        return;
+    }
+
+    SDL_SetAtomicInt(&js->running, 0);
+    for (uint32_t i = 0; i < js->worker_count; i++) {
+        SDL_SignalSemaphore(js->wake);
+    }
+    for (uint32_t i = 0; i < js->worker_count; i++) {
+        SDL_WaitThread(js->threads[i], 0);
+    }
+    SDL_DestroySemaphore(js->wake);
+}
+
+void job_system_submit(JobSystem* js, Job* jobs, uint32_t job_count,
+                       JobCounter* counter) {
+    SDL_AddAtomicInt(&counter->remaining, (int)job_count);
+
+    if (js->worker_count == 0) {
+        // Deterministic fallback, used for testing and on single core machines
+        for (uint32_t i = 0; i < job_count; i++) {
+            jobs[i].counter = counter;
+            job_run(&jobs[i]);
+        }
+        return;
+    }
+
+    JobQueue* queue = &js->queues[job_thread_index];
+    for (uint32_t i = 0; i < job_count; i++) {
+        jobs[i].counter = counter;
+        if (!job_queue_push(queue, jobs[i])) {
+            // Queue is full, no point in waiting for room
+            job_run(&jobs[i]);
+        }
+    }
+
+    uint32_t wake_count = SDL_min(job_count, js->worker_count);
+    for (uint32_t i = 0; i < wake_count; i++) {
+        SDL_SignalSemaphore(js->wake);
+    }
+}
+
+void job_system_wait(JobSystem* js, JobCounter* counter) {
+    while (SDL_GetAtomicInt(&counter->remaining) > 0) {
+        if (!job_try_run_one(js)) {
+            SDL_CPUPauseInstruction();
+        }
+    }
+}
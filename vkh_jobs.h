@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <SDL3/SDL_atomic.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_thread.h>
+
+#include "vkh_memory.h"
+
+typedef void job_func_t(void* data);
+
+struct JobCounter {
+    SDL_AtomicInt remaining;
+};
+
+struct Job {
+    job_func_t* func;
+    void* data;
+    JobCounter* counter;
+};
+
+// Ring of jobs owned by one thread. The owner pushes and pops at the tail,
+// other threads steal the oldest job from the head.
+struct JobQueue {
+    SDL_SpinLock lock;
+    Job* jobs;
+    uint32_t capacity;  // power of two
+    uint32_t head;
+    uint32_t tail;
+};
+
+struct JobSystem {
+    // Threads besides the one calling job_system_init. With zero workers
+    // jobs run inline, in submission order, on the submitting thread.
+    uint32_t worker_count;
+
+    // One queue per thread. Queue 0 belongs to the one non-worker thread
+    // that submits, the render thread.
+    JobQueue* queues;
+    SDL_Thread** threads;
+    SDL_Semaphore* wake;
+    SDL_AtomicInt running;
+};
+
+void job_system_init(JobSystem* js, MemoryArena* arena, uint32_t worker_count);
+void job_system_shutdown(JobSystem* js);
+
+void job_system_submit(JobSystem* js, Job* jobs, uint32_t job_count,
+                       JobCounter* counter);
+// Runs queued jobs on the calling thread until the counter drops to zero
+void job_system_wait(JobSystem* js, JobCounter* counter);
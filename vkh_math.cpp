@@ -2,6 +2,14 @@
 
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define VKH_MATH_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VKH_MATH_NEON 1
+#endif
+
 inline vec3 normalize(const vec3 &v) {
     float length = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
     return {v.x / length, v.y / length, v.z / length};
@@ -86,7 +94,10 @@ mat4 rotate(float angle, const vec3 &axis) {
     return result;
 }
 
-mat4 multiply(const mat4 &a, const mat4 &b) {
+// Reference implementation, the SIMD paths below must match it bit for bit.
+// They do the same multiplies and adds in the same order, so they do as long
+// as the compiler is not allowed to contract the scalar loop into FMAs.
+mat4 multiply_scalar(const mat4 &a, const mat4 &b) {
     mat4 result = {};
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
@@ -98,6 +109,44 @@ mat4 multiply(const mat4 &a, const mat4 &b) {
     return result;
 }
 
+// Row i of the result is a.data[i][k] broadcast times row k of b, summed
+mat4 multiply(const mat4 &a, const mat4 &b) {
+#if VKH_MATH_SSE
+    __m128 b0 = _mm_loadu_ps(b.data[0]);
+    __m128 b1 = _mm_loadu_ps(b.data[1]);
+    __m128 b2 = _mm_loadu_ps(b.data[2]);
+    __m128 b3 = _mm_loadu_ps(b.data[3]);
+
+    mat4 result;
+    for (int i = 0; i < 4; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a.data[i][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.data[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.data[i][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.data[i][3]), b3));
+        _mm_storeu_ps(result.data[i], row);
+    }
+    return result;
+#elif VKH_MATH_NEON
+    float32x4_t b0 = vld1q_f32(b.data[0]);
+    float32x4_t b1 = vld1q_f32(b.data[1]);
+    float32x4_t b2 = vld1q_f32(b.data[2]);
+    float32x4_t b3 = vld1q_f32(b.data[3]);
+
+    mat4 result;
+    for (int i = 0; i < 4; ++i) {
+        // vmulq + vaddq rather than vmlaq/vfmaq to stay unfused
+        float32x4_t row = vmulq_n_f32(b0, a.data[i][0]);
+        row = vaddq_f32(row, vmulq_n_f32(b1, a.data[i][1]));
+        row = vaddq_f32(row, vmulq_n_f32(b2, a.data[i][2]));
+        row = vaddq_f32(row, vmulq_n_f32(b3, a.data[i][3]));
+        vst1q_f32(result.data[i], row);
+    }
+    return result;
+#else
+    return multiply_scalar(a, b);
+#endif
+}
+
 mat4 lookAt(const vec3 &eye, const vec3 &center, const vec3 &up) {
     vec3 f = normalize(center - eye);
     vec3 s = normalize(cross(f, up));
@@ -0,0 +1,113 @@
+// Checks that the SIMD mat4 multiply matches multiply_scalar bit for bit and
+// times both. Build without FMA contraction, see build.sh, otherwise the
+// scalar reference itself changes. Exits non-zero on a mismatch.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "vkh_math.cpp"
+
+static uint32_t GLOBAL_rng_state = 0x9E3779B9;
+
+static float random_float(float range) {
+    // xorshift32, deterministic so failures reproduce
+    uint32_t x = GLOBAL_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    GLOBAL_rng_state = x;
+    return ((float)(x >> 8) / (float)(1 << 24) * 2.0f - 1.0f) * range;
+}
+
+static mat4 random_mat4(float range) {
+    mat4 result;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            result.data[i][j] = random_float(range);
+        }
+    }
+    return result;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+static bool check_multiply(const mat4& a, const mat4& b) {
+    mat4 expected = multiply_scalar(a, b);
+    mat4 actual = multiply(a, b);
+    if (memcmp(&expected, &actual, sizeof(mat4)) != 0) {
+        fprintf(stderr, "multiply differs from multiply_scalar\n");
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    const uint32_t CHECK_COUNT = 100000;
+    const uint32_t BENCH_COUNT = 4096;
+    const uint32_t BENCH_ROUNDS = 2000;
+
+    bool ok = true;
+
+    // The products the renderer actually builds, then random ones over a
+    // few magnitudes so rounding differences would show up
+    ok &= check_multiply(translate(-12.5f, 40.0f, 0.0f),
+                         scale(1.75f, 1.75f, 1.0f));
+    ok &= check_multiply(scale(0.5f, 0.5f, 1.0f), translate(3.0f, -7.0f, 0.0f));
+    ok &= check_multiply(
+        translate(100.0f, 50.0f, 0.0f),
+        createOrthographicProjection(0.0f, 1920.0f, 0.0f, 1080.0f, -1.0f,
+                                     1.0f));
+    for (uint32_t i = 0; ok && i < CHECK_COUNT; ++i) {
+        float range = (i % 3 == 0) ? 1.0f : (i % 3 == 1) ? 1000.0f : 1e-3f;
+        ok &= check_multiply(random_mat4(range), random_mat4(range));
+    }
+
+    static mat4 as[BENCH_COUNT];
+    static mat4 bs[BENCH_COUNT];
+    for (uint32_t i = 0; i < BENCH_COUNT; ++i) {
+        as[i] = random_mat4(1.0f);
+        bs[i] = random_mat4(1.0f);
+    }
+
+    // Summed so the calls can't be optimised away
+    float sink = 0.0f;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+        for (uint32_t i = 0; i < BENCH_COUNT; ++i) {
+            sink += multiply_scalar(as[i], bs[i]).data[round & 3][i & 3];
+        }
+    }
+    double scalar_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+        for (uint32_t i = 0; i < BENCH_COUNT; ++i) {
+            sink += multiply(as[i], bs[i]).data[round & 3][i & 3];
+        }
+    }
+    double simd_seconds = seconds_since(start);
+
+    double calls = (double)BENCH_COUNT * BENCH_ROUNDS;
+#if VKH_MATH_SSE
+    const char* path = "SSE";
+#elif VKH_MATH_NEON
+    const char* path = "NEON";
+#else
+    const char* path = "scalar";
+#endif
+    printf("multiply_scalar: %6.2f ns/call\n", scalar_seconds * 1e9 / calls);
+    printf("multiply (%s): %6.2f ns/call, %.2fx\n", path,
+           simd_seconds * 1e9 / calls, scalar_seconds / simd_seconds);
+    printf("bit-identical over %u products: %s (sink %g)\n", CHECK_COUNT + 3,
+           ok ? "yes" : "NO", sink);
+
+    return ok ? 0 : 1;
+}
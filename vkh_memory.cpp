@@ -1,12 +1,151 @@
 #include "vkh_memory.h"
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+const size_t ARENA_COMMIT_GRANULARITY = 64 * 1024;
+const size_t ARENA_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t arena_page_size() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static size_t arena_align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool arena_reserve(MemoryArena* arena, size_t size, uint32_t flags) {
+    size_t page_size = arena_page_size();
+    size = arena_align_up(size, page_size);
+
+    *arena = {};
+#if defined(_WIN32)
+    // NOTE: Large pages need SeLockMemoryPrivilege and can't be committed
+    // lazily, ARENA_HUGE_PAGES is ignored here
+    void* base =
+        VirtualAlloc(0, size + page_size, MEM_RESERVE, PAGE_NOACCESS);
+    if (!base) {
+        return false;
+    }
+#else
+    // Over-reserve so the arena can start on a huge page boundary, then
+    // give back the unaligned head and tail
+    size_t slack = (flags & ARENA_HUGE_PAGES) ? ARENA_HUGE_PAGE_SIZE : 0;
+    size_t mapping_size = size + page_size + slack;
+    uint8_t* mapping = (uint8_t*)mmap(0, mapping_size, PROT_NONE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS |
+                                          MAP_NORESERVE,
+                                      -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    uint8_t* base = mapping;
+    if (slack) {
+        base = (uint8_t*)arena_align_up((uintptr_t)mapping, slack);
+        size_t head = base - mapping;
+        size_t tail = slack - head;
+        if (head) {
+            munmap(mapping, head);
+        }
+        if (tail) {
+            munmap(base + size + page_size, tail);
+        }
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (flags & ARENA_HUGE_PAGES) {
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+#endif
+#endif
+
+    arena->base = (uint8_t*)base;
+    arena->size = size;
+    arena->flags = flags | ARENA_RESERVED;
+    return true;
+}
+
+void arena_release(MemoryArena* arena) {
+    if (arena->flags & ARENA_RESERVED) {
+#if defined(_WIN32)
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+        munmap(arena->base, arena->size + arena_page_size());
+#endif
+    }
+    *arena = {};
+}
+
+void arena_init(MemoryArena* arena, void* base, size_t size) {
+    *arena = {};
+    arena->base = (uint8_t*)base;
+    arena->size = size;
+    arena->committed = size;
+}
+
+static size_t arena_commit_granularity(MemoryArena* arena) {
+    return (arena->flags & ARENA_HUGE_PAGES) ? ARENA_HUGE_PAGE_SIZE
+                                             : ARENA_COMMIT_GRANULARITY;
+}
+
+// Makes [start, end) of the reservation readable and writable. Committing
+// pages that already are is harmless, so threads may race on a range.
+static void arena_commit_range(MemoryArena* arena, size_t start, size_t end) {
+#if defined(_WIN32)
+    void* result = VirtualAlloc(arena->base + start, end - start, MEM_COMMIT,
+                                PAGE_READWRITE);
+    ASSERT(result);
+#else
+    int result =
+        mprotect(arena->base + start, end - start, PROT_READ | PROT_WRITE);
+    ASSERT(result == 0);
+#endif
+    (void)result;
+}
+
+// Commits whole granules up to at least `end`, never into the guard page
+static void arena_commit(MemoryArena* arena, size_t end) {
+    size_t new_committed =
+        arena_align_up(end, arena_commit_granularity(arena));
+    if (new_committed > arena->size) {
+        new_committed = arena->size;
+    }
+
+    arena_commit_range(arena, arena->committed, new_committed);
+    arena->committed = new_committed;
+}
+
 uint8_t* arena_push(MemoryArena* arena, size_t size) {
-    // ASSERT(arena->used + size <= arena->size);
+    ASSERT(arena->used + size <= arena->size);
     uint8_t* result = arena->base + arena->used;
     arena->used += size;
+    if (arena->used > arena->committed && (arena->flags & ARENA_RESERVED)) {
+        arena_commit(arena, arena->used);
+    }
     return result;
 }
 
+uint8_t* arena_push_aligned(MemoryArena* arena, size_t size,
+                            size_t alignment) {
+    uintptr_t current = (uintptr_t)(arena->base + arena->used);
+    size_t padding = (alignment - (current & (alignment - 1))) & (alignment - 1);
+    ASSERT(arena->used + padding + size <= arena->size);
+    arena->used += padding;
+    return arena_push(arena, size);
+}
+
 temp_arena begin_temp_arena(MemoryArena* arena) {
     temp_arena temp;
     temp.parent = arena;
@@ -15,3 +154,21 @@ temp_arena begin_temp_arena(MemoryArena* arena) {
 }
 
 void end_temp_arena(temp_arena* temp) { temp->parent->used = temp->prev_used; }
+
+static thread_local MemoryArena GLOBAL_scratch_arenas[SCRATCH_ARENA_COUNT];
+
+MemoryArena* scratch_arena(MemoryArena* conflict) {
+    for (uint32_t i = 0; i < SCRATCH_ARENA_COUNT; i++) {
+        MemoryArena* arena = &GLOBAL_scratch_arenas[i];
+        if (arena == conflict) {
+            continue;
+        }
+        if (!arena->base) {
+            bool reserved = arena_reserve(arena, SCRATCH_ARENA_SIZE, 0);
+            ASSERT(reserved);
+            (void)reserved;
+        }
+        return arena;
+    }
+    return 0;
+}
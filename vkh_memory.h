@@ -2,12 +2,20 @@
 
 #include <stddef.h>
 #include <stdint.h>
-#include <stddef.h>
+
+enum ArenaFlags {
+    // Back the arena with transparent huge pages where the OS supports it
+    ARENA_HUGE_PAGES = 1 << 0,
+    // Set by arena_reserve, pushes commit pages as they reach them
+    ARENA_RESERVED = 1 << 1,
+};
 
 struct MemoryArena {
     uint8_t* base;
     size_t size;
     size_t used;
+    size_t committed;  // [base, base + committed) is readable and writable
+    uint32_t flags;
 };
 
 struct temp_arena {
@@ -15,6 +23,41 @@ struct temp_arena {
     size_t prev_used;
 };
 
+// Reserves address space for size bytes plus a trailing guard page, nothing
+// is committed until pushed. Overflowing the arena faults on the guard page.
+bool arena_reserve(MemoryArena* arena, size_t size, uint32_t flags);
+void arena_release(MemoryArena* arena);
+// Wraps memory that is already committed, e.g. a block pushed off another
+// arena
+void arena_init(MemoryArena* arena, void* base, size_t size);
+
 uint8_t* arena_push(MemoryArena* arena, size_t size);
+// alignment must be a power of two
+uint8_t* arena_push_aligned(MemoryArena* arena, size_t size, size_t alignment);
 temp_arena begin_temp_arena(MemoryArena* arena);
 void end_temp_arena(temp_arena* temp);
+
+// NOTE: Every thread owns SCRATCH_ARENA_COUNT reserved scratch arenas,
+// created on first use. Pass the arena the caller pushes its results to as
+// conflict, so a nested scratch scope never resets memory still in use.
+const uint32_t SCRATCH_ARENA_COUNT = 2;
+const size_t SCRATCH_ARENA_SIZE = 512 * 1024 * 1024;  // reserved, not committed
+MemoryArena* scratch_arena(MemoryArena* conflict);
+
+// Resets the arena to where it was when the scope ends
+struct TempArenaScope {
+    temp_arena temp;
+
+    explicit TempArenaScope(MemoryArena* arena)
+        : temp(begin_temp_arena(arena)) {}
+    ~TempArenaScope() { end_temp_arena(&temp); }
+};
+
+struct ScratchScope {
+    MemoryArena* arena;
+    temp_arena temp;
+
+    explicit ScratchScope(MemoryArena* conflict = 0)
+        : arena(scratch_arena(conflict)), temp(begin_temp_arena(arena)) {}
+    ~ScratchScope() { end_temp_arena(&temp); }
+};
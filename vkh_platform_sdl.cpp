@@ -14,11 +14,18 @@
 #else
 #define assert(expr)
 #endif
+// vkh_memory.cpp is shared with the game, which spells it ASSERT
+#define ASSERT(expr) assert(expr)
 
 #define ArrayCount(x) (sizeof(x) / sizeof((x)[0]))
 
 #include "vkh_memory.cpp"
+#include "vkh_jobs.cpp"
+#include "vkh_profiler.cpp"
+#include "vkh_gpu_memory.cpp"
 #include "vkh_renderer.cpp"
+#include "vkh_render_thread.cpp"
+#include "image.cpp"
 
 #include <SDL3/SDL.h>
 #include "SDL3/SDL_init.h"
@@ -29,49 +36,189 @@
 #include "SDL3/SDL_events.h"
 #include "SDL3/SDL_video.h"
 
+#if SDL_PLATFORM_LINUX
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 bool GLOBAL_running = true;
 bool GLOBAL_fullscreen = false;
 
 struct GameCode {
+    SDL_SharedObject* so_handle;
+    game_update_t gameUpdate;
+    game_render_t gameRender;
+    char path[64];  // private copy of the library, removed on unload
+};
+
 #if SDL_PLATFORM_WINDOWS
-    const char* sourcePath = ".\\build\\vkh_game.dll";
-    const char *newpath = ".\\build\\gamecopy.dll";
+#define GAME_CODE_DIRECTORY ".\\build\\"
+#define GAME_CODE_NAME "vkh_game.dll"
+#define GAME_CODE_COPY_FORMAT ".\\build\\game_copy_%u.dll"
 #else
-    const char *sourcePath = "./build/vkh_game.so";
-    const char *newpath = "./build/game_copy.so";
+#define GAME_CODE_DIRECTORY "./build/"
+#define GAME_CODE_NAME "vkh_game.so"
+#define GAME_CODE_COPY_FORMAT "./build/game_copy_%u.so"
+#endif
+
+// NOTE: Copying and loading a new library takes long enough to hitch a
+// frame, so the watcher thread does it and parks the result in staged.
+// The main loop swaps it in between frames. Every load gets its own copy
+// because the loader hands back the already loaded library for a path it
+// has seen, and the old copy stays loaded until the swap.
+struct GameCodeWatcher {
+    SDL_Thread* thread;
+    SDL_AtomicInt running;
+    SDL_AtomicInt staged_ready;  // staged belongs to the main thread while set
+    GameCode staged;
+    u32 generation;
+#if SDL_PLATFORM_LINUX
+    int inotify_fd;
 #endif
-    SDL_SharedObject* so_handle;
-    game_update_t gameUpdateAndRender;
-    SDL_Time lastModified;
 };
 
 void platform_free_game_code(GameCode* gameCode) {
     SDL_UnloadObject(gameCode->so_handle);
+    SDL_RemovePath(gameCode->path);
+    *gameCode = {};
 }
 
-void platform_load_game_code(GameCode* gc) {
-    SDL_PathInfo info;
-    SDL_GetPathInfo(gc->sourcePath, &info);
+bool platform_load_game_code(GameCode* gc, u32 generation) {
+    *gc = {};
+    SDL_snprintf(gc->path, sizeof(gc->path), GAME_CODE_COPY_FORMAT,
+                 generation);
+    if (!SDL_CopyFile(GAME_CODE_DIRECTORY GAME_CODE_NAME, gc->path)) {
+        return false;
+    }
+
+    gc->so_handle = SDL_LoadObject(gc->path);
+    if (gc->so_handle) {
+        gc->gameUpdate =
+            (game_update_t)SDL_LoadFunction(gc->so_handle, "game_update");
+        gc->gameRender =
+            (game_render_t)SDL_LoadFunction(gc->so_handle, "game_render");
+    }
+
+    if (!gc->gameUpdate || !gc->gameRender) {
+        fprintf(stderr, "Failed to load game code: %s\n", SDL_GetError());
+        if (gc->so_handle) {
+            SDL_UnloadObject(gc->so_handle);
+        }
+        SDL_RemovePath(gc->path);
+        *gc = {};
+        return false;
+    }
+    return true;
+}
 
-    gc->lastModified = info.modify_time;
+#if SDL_PLATFORM_LINUX
+// Blocks until the library has been rewritten, or for at most 100 ms.
+// The build renames a finished file into place, IN_CLOSE_WRITE also
+// catches a linker writing it directly once it's done.
+static bool game_code_wait_for_change(GameCodeWatcher* watcher) {
+    pollfd fd = {watcher->inotify_fd, POLLIN, 0};
+    if (poll(&fd, 1, 100) <= 0) {
+        return false;
+    }
 
-    SDL_CopyFile(gc->sourcePath, gc->newpath);
-    gc->so_handle = SDL_LoadObject(gc->newpath);
-    assert(gc->so_handle);
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length = read(watcher->inotify_fd, buffer, sizeof(buffer));
 
-    gc->gameUpdateAndRender = (game_update_t)SDL_LoadFunction(
-        gc->so_handle, "game_update_and_render");
-    assert(gc->gameUpdateAndRender);
+    bool changed = false;
+    for (ssize_t at = 0; at < length;) {
+        inotify_event* event = (inotify_event*)(buffer + at);
+        if (event->len && SDL_strcmp(event->name, GAME_CODE_NAME) == 0) {
+            changed = true;
+        }
+        at += sizeof(inotify_event) + event->len;
+    }
+    return changed;
 }
+#else
+// NOTE: No change notification, poll the file instead. A file whose size
+// or time still moves between polls is being written, wait for it to settle.
+static bool game_code_wait_for_change(GameCodeWatcher* watcher) {
+    static SDL_PathInfo last;
+    static bool settling;
 
-void platform_reload_game_code(GameCode* gameCode) {
+    SDL_Delay(100);
     SDL_PathInfo info;
-    SDL_GetPathInfo(gameCode->sourcePath, &info);
-    if (info.modify_time > gameCode->lastModified) {
-        platform_free_game_code(gameCode);
-        platform_load_game_code(gameCode);
-        fprintf(stderr, "Game code reloaded\n");
+    if (!SDL_GetPathInfo(GAME_CODE_DIRECTORY GAME_CODE_NAME, &info)) {
+        return false;
+    }
+
+    bool moved = info.modify_time != last.modify_time || info.size != last.size;
+    bool first = last.modify_time == 0;
+    last = info;
+    if (moved) {
+        settling = !first;
+        return false;
     }
+    bool changed = settling;
+    settling = false;
+    return changed;
+}
+#endif
+
+static int game_code_watcher_main(void* data) {
+    GameCodeWatcher* watcher = (GameCodeWatcher*)data;
+
+    while (SDL_GetAtomicInt(&watcher->running)) {
+        if (!game_code_wait_for_change(watcher)) {
+            continue;
+        }
+
+        // One staged library at a time, the main loop takes it next frame
+        while (SDL_GetAtomicInt(&watcher->staged_ready) &&
+               SDL_GetAtomicInt(&watcher->running)) {
+            SDL_Delay(1);
+        }
+
+        if (platform_load_game_code(&watcher->staged, ++watcher->generation)) {
+            SDL_SetAtomicInt(&watcher->staged_ready, 1);
+        }
+    }
+    return 0;
+}
+
+void game_code_watcher_start(GameCodeWatcher* watcher, u32 generation) {
+    watcher->generation = generation;
+    SDL_SetAtomicInt(&watcher->staged_ready, 0);
+    SDL_SetAtomicInt(&watcher->running, 1);
+#if SDL_PLATFORM_LINUX
+    watcher->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    assert(watcher->inotify_fd >= 0);
+    int watch = inotify_add_watch(watcher->inotify_fd, GAME_CODE_DIRECTORY,
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+    assert(watch >= 0);
+#endif
+    watcher->thread =
+        SDL_CreateThread(game_code_watcher_main, "vkh_game_watcher", watcher);
+    assert(watcher->thread);
+}
+
+void game_code_watcher_stop(GameCodeWatcher* watcher) {
+    SDL_SetAtomicInt(&watcher->running, 0);
+    SDL_WaitThread(watcher->thread, 0);
+#if SDL_PLATFORM_LINUX
+    close(watcher->inotify_fd);
+#endif
+    if (SDL_GetAtomicInt(&watcher->staged_ready)) {
+        platform_free_game_code(&watcher->staged);
+    }
+}
+
+// Called between frames, nothing runs game code while the pointers change
+void platform_reload_game_code(GameCodeWatcher* watcher, GameCode* gameCode) {
+    if (!SDL_GetAtomicInt(&watcher->staged_ready)) {
+        return;
+    }
+
+    platform_free_game_code(gameCode);
+    *gameCode = watcher->staged;
+    SDL_SetAtomicInt(&watcher->staged_ready, 0);
+    fprintf(stderr, "Game code reloaded from %s\n", gameCode->path);
 }
 
 void ResetInputKeys(GameInput* input){
@@ -81,8 +228,7 @@ void ResetInputKeys(GameInput* input){
 }
 
 void handle_SDL_event(SDL_Event* event, GameInput* input,
-                      VulkanContext* renderer_context,
-                      MemoryArena* renderer_arena) {
+                      RenderThread* render_thread) {
     switch (event->type) {
         case SDL_EVENT_QUIT: {
             GLOBAL_running = false;
@@ -101,6 +247,9 @@ void handle_SDL_event(SDL_Event* event, GameInput* input,
                 case SDL_SCANCODE_D: {
                     input->digital_inputs[D_RIGHT].is_down = true;
                 } break;
+                case SDL_SCANCODE_G: {
+                    input->digital_inputs[TOGGLE_GPU_PARTICLES].is_down = true;
+                } break;
                 case SDL_SCANCODE_F11: {
                     GLOBAL_fullscreen = !GLOBAL_fullscreen;
                     SDL_Window *window = SDL_GetWindowFromEvent(event);
@@ -124,6 +273,9 @@ void handle_SDL_event(SDL_Event* event, GameInput* input,
                 case SDL_SCANCODE_D: {
                     input->digital_inputs[D_RIGHT].is_down = false;
                 } break;
+                case SDL_SCANCODE_G: {
+                    input->digital_inputs[TOGGLE_GPU_PARTICLES].is_down = false;
+                } break;
                 default: {
                 }
             }
@@ -131,9 +283,8 @@ void handle_SDL_event(SDL_Event* event, GameInput* input,
         case SDL_EVENT_WINDOW_RESIZED: {
             printf("Window resized: width: %d, height: %d\n",
                    event->window.data1, event->window.data2);
-            renderer_context->WindowDrawableAreaWidth = event->window.data1;
-            renderer_context->WindowDrawableAreaHeight = event->window.data2;
-            RecreateSwapchainResources(renderer_context, renderer_arena);
+            render_thread_request_resize(render_thread, event->window.data1,
+                                         event->window.data2);
             input->window_width = event->window.data1;
             input->window_height = event->window.data2;
         } break;
@@ -147,58 +298,107 @@ void handle_SDL_event(SDL_Event* event, GameInput* input,
         case SDL_EVENT_MOUSE_BUTTON_DOWN: {
             // printf("Mouse button down: button: %d, x: %f, y: %f\n",
             // event->button.button, event->button.x, event->button.y);
-            input->digital_inputs[KEY_A].is_down = true;
+            key button =
+                event->button.button == SDL_BUTTON_RIGHT ? KEY_X : KEY_A;
+            input->digital_inputs[button].is_down = true;
         } break;
         case SDL_EVENT_MOUSE_BUTTON_UP: {
             // printf("Mouse button up: button: %d, x: %f, y: %f\n",
             // event->button.button, event->button.x, event->button.y);
-            input->digital_inputs[KEY_A].is_down = false;
+            key button =
+                event->button.button == SDL_BUTTON_RIGHT ? KEY_X : KEY_A;
+            input->digital_inputs[button].is_down = false;
+        } break;
+        case SDL_EVENT_MOUSE_WHEEL: {
+            input->mouse_wheel += event->wheel.y;
         } break;
     }
 }
 
 
 
+// Command line:
+//   --headless      render offscreen without a window, e.g. on lavapipe
+//   --frames N      headless only, number of frames to run (default 300)
+//   --dump PATH     headless only, write the last frame to PATH as BMP
+//   --trace PATH    record CPU scopes and GPU zones, written to PATH as
+//                   Chrome trace JSON on exit
+struct PlatformOptions {
+    bool headless;
+    uint32_t frames = 300;
+    const char* dump_path;
+    const char* trace_path;
+};
+
+PlatformOptions platform_parse_options(int argc, char** argv) {
+    PlatformOptions options = {};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.frames = (uint32_t)SDL_strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            options.dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.trace_path = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+        }
+    }
+
+    return options;
+}
+
 int main(int argc, char** argv) {
     int window_width = 800;
     int window_height = 600;
 
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Window* window =
-        SDL_CreateWindow("Vulkan Heart", window_width, window_height,
-                         SDL_WINDOW_VULKAN | SDL_WINDOW_HIGH_PIXEL_DENSITY);
-    assert(window);
-
-    SDL_DisplayID display_id = SDL_GetDisplayForWindow(window);
+    PlatformOptions options = platform_parse_options(argc, argv);
 
-    float display_refresh_rate = 60;
+    SDL_Window* window = 0;
+    float window_pixel_density = 1.0f;
 
-    int count = 0;
-    SDL_DisplayMode** display_modes = SDL_GetFullscreenDisplayModes(display_id, &count);
+    if (options.headless) {
+        SDL_Init(0);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
+        window =
+            SDL_CreateWindow("Vulkan Heart", window_width, window_height,
+                             SDL_WINDOW_VULKAN | SDL_WINDOW_HIGH_PIXEL_DENSITY);
+        assert(window);
 
-    for (int i = 0; i < count; i++) {
-        SDL_DisplayMode *mode =  display_modes[i];
-        display_refresh_rate = mode->refresh_rate;
-        break;
+        window_pixel_density = SDL_GetWindowDisplayScale(window);
+        printf("Window pixel density: %f\n", window_pixel_density);
+        SDL_SetWindowResizable(window, true);
+        SDL_SetWindowFullscreen(window, GLOBAL_fullscreen);
     }
 
-    float window_pixel_density = SDL_GetWindowDisplayScale(window);
-    printf("Window pixel density: %f\n", window_pixel_density);
-    SDL_SetWindowResizable(window, true);
-    SDL_SetWindowFullscreen(window, GLOBAL_fullscreen);
-
     GameCode gameCode;
-    SDL_PathInfo info;
-    SDL_GetPathInfo(gameCode.sourcePath, &info);
-    gameCode.lastModified = info.modify_time;
-    platform_load_game_code(&gameCode);
+    bool loaded = platform_load_game_code(&gameCode, 0);
+    assert(loaded);
 
     MemoryArena renderer_arena = {};
-    renderer_arena.base = (uint8_t*)malloc(megabytes(128));
-    renderer_arena.size = megabytes(128);
-    renderer_arena.used = 0;
+    bool reserved = arena_reserve(&renderer_arena, megabytes(128), 0);
+    assert(reserved);
+
+    // Roughly the last few hundred frames
+    profiler_init(&GLOBAL_profiler, &renderer_arena, 1 << 16,
+                  options.trace_path != 0);
+
+    // Set VKH_SINGLE_THREADED to run jobs inline and in order
+    uint32_t worker_count = 0;
+    if (!SDL_getenv("VKH_SINGLE_THREADED")) {
+        int cpu_count = SDL_GetNumLogicalCPUCores();
+        worker_count = cpu_count > 1 ? (uint32_t)(cpu_count - 1) : 0;
+    }
+
+    JobSystem job_system = {};
+    job_system_init(&job_system, &renderer_arena, worker_count);
 
     VulkanContext context = {};
+    context.headless = options.headless;
+    context.jobs = &job_system;
     context.WindowDrawableAreaWidth = window_width;
     context.WindowDrawableAreaHeight = window_height;
     context.WindowPixelDensity = window_pixel_density;
@@ -206,61 +406,151 @@ int main(int argc, char** argv) {
     RendererInit(&context, window, &renderer_arena);
 
     GameMemory game_memory = {};
-    game_memory.permanent_store_size = megabytes((uint64_t)256);
-    game_memory.permanent_store = malloc(game_memory.permanent_store_size);
+    reserved = arena_reserve(&game_memory.permanent_arena, megabytes(256), 0);
+    assert(reserved);
 
-    game_memory.transient_store_size = gigabytes((uint64_t)2);
-    game_memory.transient_store = malloc(game_memory.transient_store_size);
+    // From here on only the render thread uses context and renderer_arena
+    RenderThread render_thread = {};
+    render_thread_start(&render_thread, &context, &renderer_arena);
 
     uint64_t timer_frequency =
         SDL_GetPerformanceFrequency();  // counts per second
 
-    const f32 TARGET_FRAMERATE = display_refresh_rate;
-    const f32 TARGET_FRAME_TIME = 1.0f / TARGET_FRAMERATE;
+    // NOTE: The simulation runs at a fixed rate whatever the display does.
+    // Frame pacing comes from the render thread, which blocks on the
+    // swapchain, so the game thread waits for a free push buffer instead
+    // of sleeping.
+    const f64 SECONDS_PER_UPDATE = 1.0 / 60.0;
+    // Past this a slow frame drops simulated time instead of spiralling
+    const f64 MAX_FRAME_SECONDS = 0.25;
 
     // Main event loop
     SDL_Event event;
     GameInput input = {0};
-    input.window_pixel_density = SDL_GetWindowPixelDensity(window);
+    input.seconds_per_update = SECONDS_PER_UPDATE;
+    input.window_pixel_density =
+        window ? SDL_GetWindowPixelDensity(window) : window_pixel_density;
     input.window_height = window_height;
     input.window_width = window_width;
 
-    while (GLOBAL_running) {
+    if (options.headless) {
+        // Fixed input and exactly one update per frame, so every run
+        // produces the same frames
+        input.mouse_x = window_width / 2.0f;
+        input.mouse_y = window_height / 2.0f;
+
         uint64_t ticks_start = SDL_GetPerformanceCounter();
 
-        input.seconds_passed_since_last_frame = TARGET_FRAME_TIME * 1000.0f;
+        for (uint32_t frame = 0; frame < options.frames; frame++) {
+            PROFILE_SCOPE("Frame");
+
+            RenderFrame* render_frame;
+            {
+                PROFILE_SCOPE("WaitForPushBuffer");
+                render_frame = render_thread_begin_frame(&render_thread);
+            }
+
+            {
+                PROFILE_SCOPE("GameUpdate");
+                gameCode.gameUpdate(&game_memory, &input);
+            }
+
+            {
+                PROFILE_SCOPE("GameRender");
+                gameCode.gameRender(&game_memory, &input,
+                                    &render_frame->push_buffer, 1.0f);
+            }
+
+            render_frame->capture =
+                options.dump_path && frame + 1 == options.frames;
+            render_thread_submit_frame(&render_thread, render_frame);
+        }
 
-        while (SDL_PollEvent(&event)) {
-            handle_SDL_event(&event, &input, &context, &renderer_arena);
+        // Includes the frames still in flight
+        render_thread_stop(&render_thread);
+        const uint32_t* pixels = RendererFinishCapture(&context);
+
+        f64 seconds = (f64)(SDL_GetPerformanceCounter() - ticks_start) /
+                      timer_frequency;
+        fprintf(stderr, "Headless: %u frames in %.3f s, %.3f ms/frame, %.1f fps\n",
+                options.frames, seconds,
+                options.frames ? seconds * 1000.0 / options.frames : 0.0,
+                seconds > 0.0 ? options.frames / seconds : 0.0);
+
+        if (options.dump_path && options.frames > 0) {
+            writeBMP(options.dump_path, pixels, context.swapchain_extent.width,
+                     context.swapchain_extent.height);
+            fprintf(stderr, "Wrote %s\n", options.dump_path);
         }
-        platform_reload_game_code(&gameCode);
 
-        gameCode.gameUpdateAndRender(&game_memory, &input);
+        GLOBAL_running = false;
+    }
 
-        GameState* game_state = (GameState*)(game_memory.permanent_store);
-        RendererDrawFrame(&context, &renderer_arena,
-                          &game_state->frame_push_buffer);
+    GameCodeWatcher game_code_watcher = {};
+    if (!options.headless) {
+        game_code_watcher_start(&game_code_watcher, 0);
+    }
 
-        uint64_t ticks_end = SDL_GetPerformanceCounter();
-        uint64_t elapsed_ticks = ticks_end - ticks_start;
+    uint64_t last_ticks = SDL_GetPerformanceCounter();
+    f64 accumulator = 0.0;
 
-        f32 seconds_elapsed = (f32)elapsed_ticks / timer_frequency;
-        if (seconds_elapsed < TARGET_FRAME_TIME) {
-            // printf("Warning: Frame took too short to render (%f s)\n", seconds_elapsed);
-            ticks_end = SDL_GetPerformanceCounter();
-            elapsed_ticks = ticks_end - ticks_start;
-            seconds_elapsed = (f32)elapsed_ticks / timer_frequency;
-            SDL_DelayPrecise((TARGET_FRAME_TIME - seconds_elapsed)*1000000000.0f);
+    while (GLOBAL_running) {
+        PROFILE_SCOPE("Frame");
+
+        uint64_t ticks = SDL_GetPerformanceCounter();
+        f64 frame_seconds = (f64)(ticks - last_ticks) / timer_frequency;
+        last_ticks = ticks;
+        accumulator += SDL_min(frame_seconds, MAX_FRAME_SECONDS);
+
+        {
+            PROFILE_SCOPE("PollEvents");
+            while (SDL_PollEvent(&event)) {
+                handle_SDL_event(&event, &input, &render_thread);
+            }
         }
 
-        ticks_end = SDL_GetPerformanceCounter();
-        elapsed_ticks = ticks_end - ticks_start;
+        platform_reload_game_code(&game_code_watcher, &gameCode);
 
-        f32 fps = (f32)timer_frequency / elapsed_ticks;
-        char buffer[256];
-        sprintf(buffer, "FPS: %f.2", fps);
-        SDL_SetWindowTitle(window, buffer);
+        while (accumulator >= SECONDS_PER_UPDATE) {
+            PROFILE_SCOPE("GameUpdate");
+            gameCode.gameUpdate(&game_memory, &input);
+            accumulator -= SECONDS_PER_UPDATE;
+        }
+
+        RenderFrame* render_frame;
+        {
+            PROFILE_SCOPE("WaitForPushBuffer");
+            render_frame = render_thread_begin_frame(&render_thread);
+        }
+
+        {
+            PROFILE_SCOPE("GameRender");
+            f32 alpha = (f32)(accumulator / SECONDS_PER_UPDATE);
+            gameCode.gameRender(&game_memory, &input,
+                                &render_frame->push_buffer, alpha);
+            input.mouse_wheel = 0.0f;
+        }
+
+        render_thread_submit_frame(&render_thread, render_frame);
+
+        if (frame_seconds > 0.0) {
+            char buffer[256];
+            SDL_snprintf(buffer, sizeof(buffer), "FPS: %.2f",
+                         1.0 / frame_seconds);
+            SDL_SetWindowTitle(window, buffer);
+        }
     }
 
+    if (!options.headless) {
+        game_code_watcher_stop(&game_code_watcher);
+        render_thread_stop(&render_thread);
+    }
+    platform_free_game_code(&gameCode);
+    job_system_shutdown(&job_system);
+
+    // Workers are joined, nothing records into the ring anymore
+    if (options.trace_path) {
+        profiler_write_chrome_trace(&GLOBAL_profiler, options.trace_path);
+    }
     SDL_Quit();
 }
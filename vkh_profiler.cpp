@@ -0,0 +1,83 @@
+#include "vkh_profiler.h"
+
+#include <stdio.h>
+
+Profiler GLOBAL_profiler = {};
+
+void profiler_init(Profiler* profiler, MemoryArena* arena, uint32_t capacity,
+                   bool enabled) {
+    assert(capacity && (capacity & (capacity - 1)) == 0);
+
+    profiler->enabled = enabled;
+    profiler->capacity = capacity;
+    profiler->events = 0;
+    SDL_SetAtomicInt(&profiler->write_index, 0);
+    profiler->timer_frequency = SDL_GetPerformanceFrequency();
+    profiler->start_ticks = SDL_GetPerformanceCounter();
+
+    if (enabled) {
+        profiler->events = (ProfileEvent*)arena_push_aligned(
+            arena, sizeof(ProfileEvent) * capacity, 64);
+    }
+}
+
+void profiler_record(Profiler* profiler, const char* name, uint64_t start,
+                     uint64_t end, uint64_t track) {
+    if (!profiler->enabled) {
+        return;
+    }
+
+    uint32_t index = (uint32_t)SDL_AddAtomicInt(&profiler->write_index, 1);
+    ProfileEvent* event = &profiler->events[index & (profiler->capacity - 1)];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->track = track;
+}
+
+static double profiler_ticks_to_us(Profiler* profiler, uint64_t ticks) {
+    return (double)ticks * 1000000.0 / (double)profiler->timer_frequency;
+}
+
+bool profiler_write_chrome_trace(Profiler* profiler, const char* path) {
+    if (!profiler->enabled) {
+        return false;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Profiler: could not open %s\n", path);
+        return false;
+    }
+
+    uint32_t written = (uint32_t)SDL_GetAtomicInt(&profiler->write_index);
+    uint32_t count = SDL_min(written, profiler->capacity);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,"
+            "\"args\":{\"name\":\"GPU\"}}",
+            (unsigned long long)PROFILER_GPU_TRACK);
+
+    for (uint32_t i = written - count; i != written; i++) {
+        ProfileEvent* event = &profiler->events[i & (profiler->capacity - 1)];
+
+        // GPU events are converted from device ticks and can land a little
+        // before the profiler started
+        uint64_t start = SDL_max(event->start, profiler->start_ticks);
+        uint64_t end = SDL_max(event->end, start);
+
+        fprintf(file,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                event->name, (unsigned long long)event->track,
+                profiler_ticks_to_us(profiler, start - profiler->start_ticks),
+                profiler_ticks_to_us(profiler, end - start));
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    fprintf(stderr, "Profiler: wrote %u events to %s\n", count, path);
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <SDL3/SDL_atomic.h>
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_timer.h>
+
+#include "vkh_memory.h"
+
+// GPU zones go on their own track in the trace
+const uint64_t PROFILER_GPU_TRACK = 0xFFFFFFFF;
+
+// Times are SDL performance counter ticks. name must outlive the profiler,
+// in practice a string literal.
+struct ProfileEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint64_t track;  // SDL_ThreadID, or PROFILER_GPU_TRACK
+};
+
+// NOTE: Lock-free ring, writers claim a slot with one atomic add and the
+// oldest events are overwritten. Reading is only safe while nobody records,
+// e.g. between frames or at shutdown.
+struct Profiler {
+    bool enabled;
+    ProfileEvent* events;
+    uint32_t capacity;  // power of two
+    SDL_AtomicInt write_index;
+    uint64_t timer_frequency;
+    uint64_t start_ticks;
+};
+
+extern Profiler GLOBAL_profiler;
+
+// Recording is a no-op unless enabled, capacity must be a power of two
+void profiler_init(Profiler* profiler, MemoryArena* arena, uint32_t capacity,
+                   bool enabled);
+void profiler_record(Profiler* profiler, const char* name, uint64_t start,
+                     uint64_t end, uint64_t track);
+// Writes everything still in the ring as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev)
+bool profiler_write_chrome_trace(Profiler* profiler, const char* path);
+
+struct ProfileScope {
+    const char* name;
+    uint64_t start;
+
+    ProfileScope(const char* scope_name) {
+        name = scope_name;
+        start = GLOBAL_profiler.enabled ? SDL_GetPerformanceCounter() : 0;
+    }
+
+    ~ProfileScope() {
+        if (GLOBAL_profiler.enabled) {
+            profiler_record(&GLOBAL_profiler, name, start,
+                            SDL_GetPerformanceCounter(),
+                            SDL_GetCurrentThreadID());
+        }
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
@@ -0,0 +1,128 @@
+#include "vkh_render_thread.h"
+
+static void frame_queue_init(FrameQueue* queue) {
+    SDL_SetAtomicInt(&queue->head, 0);
+    SDL_SetAtomicInt(&queue->tail, 0);
+    queue->ready = SDL_CreateSemaphore(0);
+}
+
+static void frame_queue_push(FrameQueue* queue, RenderFrame* frame) {
+    int tail = SDL_GetAtomicInt(&queue->tail);
+    assert(tail - SDL_GetAtomicInt(&queue->head) < (int)RENDER_FRAME_COUNT);
+
+    queue->frames[tail % RENDER_FRAME_COUNT] = frame;
+    SDL_SetAtomicInt(&queue->tail, tail + 1);
+    SDL_SignalSemaphore(queue->ready);
+}
+
+static RenderFrame* frame_queue_pop(FrameQueue* queue) {
+    SDL_WaitSemaphore(queue->ready);
+
+    int head = SDL_GetAtomicInt(&queue->head);
+    RenderFrame* frame = queue->frames[head % RENDER_FRAME_COUNT];
+    SDL_SetAtomicInt(&queue->head, head + 1);
+    return frame;
+}
+
+static int render_thread_main(void* data) {
+    RenderThread* rt = (RenderThread*)data;
+    VulkanContext* context = rt->context;
+
+    for (;;) {
+        RenderFrame* frame;
+        {
+            PROFILE_SCOPE("WaitForSubmittedFrame");
+            frame = frame_queue_pop(&rt->submitted_frames);
+        }
+        if (frame->quit) {
+            break;
+        }
+
+        if (SDL_SetAtomicInt(&rt->resize_pending, 0)) {
+            context->WindowDrawableAreaWidth =
+                SDL_GetAtomicInt(&rt->resize_width);
+            context->WindowDrawableAreaHeight =
+                SDL_GetAtomicInt(&rt->resize_height);
+            RecreateSwapchainResources(context, rt->renderer_arena);
+        }
+
+        if (frame->capture) {
+            RendererRequestCapture(context);
+        }
+
+        RendererDrawFrame(context, rt->renderer_arena, &frame->push_buffer);
+        frame_queue_push(&rt->free_frames, frame);
+    }
+
+    return 0;
+}
+
+void render_thread_start(RenderThread* rt, VulkanContext* context,
+                         MemoryArena* renderer_arena) {
+    rt->context = context;
+    rt->renderer_arena = renderer_arena;
+    SDL_SetAtomicInt(&rt->resize_pending, 0);
+
+    frame_queue_init(&rt->free_frames);
+    frame_queue_init(&rt->submitted_frames);
+
+    for (uint32_t i = 0; i < RENDER_FRAME_COUNT; i++) {
+        RenderFrame* frame = &rt->frames[i];
+        *frame = {};
+        bool reserved = arena_reserve(&frame->push_buffer.arena,
+                                      RENDER_PUSH_BUFFER_SIZE,
+                                      ARENA_HUGE_PAGES);
+        assert(reserved);
+        reserved = arena_reserve(&frame->push_buffer.static_arena,
+                                 RENDER_STATIC_BUFFER_SIZE, 0);
+        assert(reserved);
+        frame_queue_push(&rt->free_frames, frame);
+    }
+
+    rt->thread = SDL_CreateThread(render_thread_main, "vkh_render", rt);
+    assert(rt->thread);
+}
+
+void render_thread_stop(RenderThread* rt) {
+    RenderFrame* frame = render_thread_begin_frame(rt);
+    frame->quit = true;
+    render_thread_submit_frame(rt, frame);
+
+    SDL_WaitThread(rt->thread, 0);
+    rt->thread = 0;
+
+    SDL_DestroySemaphore(rt->free_frames.ready);
+    SDL_DestroySemaphore(rt->submitted_frames.ready);
+    for (uint32_t i = 0; i < RENDER_FRAME_COUNT; i++) {
+        arena_release(&rt->frames[i].push_buffer.arena);
+        arena_release(&rt->frames[i].push_buffer.static_arena);
+    }
+}
+
+RenderFrame* render_thread_begin_frame(RenderThread* rt) {
+    RenderFrame* frame = frame_queue_pop(&rt->free_frames);
+
+    // Committed pages stay committed, later frames don't fault them in again
+    frame->push_buffer.arena.used = 0;
+    frame->push_buffer.number_of_entries = 0;
+    frame->push_buffer.current_layer = 0;
+    frame->push_buffer.camera = {0.0f, 0.0f, 1.0f};
+    SDL_zeroa(frame->push_buffer.screen_space_layers);
+    frame->push_buffer.static_arena.used = 0;
+    frame->push_buffer.number_of_static_entries = 0;
+    frame->push_buffer.open_static_layer = 0;
+    // resident_static_hashes is the renderer's answer, kept for the game
+    frame->capture = false;
+    frame->quit = false;
+    return frame;
+}
+
+void render_thread_submit_frame(RenderThread* rt, RenderFrame* frame) {
+    frame_queue_push(&rt->submitted_frames, frame);
+}
+
+void render_thread_request_resize(RenderThread* rt, int width, int height) {
+    SDL_SetAtomicInt(&rt->resize_width, width);
+    SDL_SetAtomicInt(&rt->resize_height, height);
+    SDL_SetAtomicInt(&rt->resize_pending, 1);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <SDL3/SDL_atomic.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_thread.h>
+
+#include "vkh_memory.h"
+#include "vkh_renderer.h"
+
+// The game builds frame N+1 while the render thread records and presents
+// frame N. With two push buffers the game never runs more than one frame
+// ahead of the renderer.
+const uint32_t RENDER_FRAME_COUNT = 2;
+const size_t RENDER_PUSH_BUFFER_SIZE = 1024 * 1024 * 256;  // 256 MB reserved
+// Static layer content, only written in frames where a layer is dirty
+const size_t RENDER_STATIC_BUFFER_SIZE = 1024 * 1024 * 64;  // 64 MB reserved
+
+struct RenderFrame {
+    PushBuffer push_buffer;  // backed by its own reserved arenas
+    bool capture;            // headless, read this frame back
+    bool quit;               // the render thread exits instead of drawing
+};
+
+// NOTE: Single producer, single consumer ring. Only the producer writes
+// tail and only the consumer writes head. ready counts the frames in the
+// ring so an empty queue sleeps instead of spinning. At most
+// RENDER_FRAME_COUNT frames exist, the ring can't overflow.
+struct FrameQueue {
+    RenderFrame* frames[RENDER_FRAME_COUNT];
+    SDL_AtomicInt head;
+    SDL_AtomicInt tail;
+    SDL_Semaphore* ready;
+};
+
+struct RenderThread {
+    VulkanContext* context;
+    MemoryArena* renderer_arena;  // only the render thread touches it
+
+    RenderFrame frames[RENDER_FRAME_COUNT];
+    FrameQueue free_frames;       // render thread -> game thread
+    FrameQueue submitted_frames;  // game thread -> render thread
+    SDL_Thread* thread;
+
+    // Written by the game thread on window resize, the swapchain is
+    // recreated on the render thread before its next frame
+    SDL_AtomicInt resize_pending;
+    SDL_AtomicInt resize_width;
+    SDL_AtomicInt resize_height;
+};
+
+void render_thread_start(RenderThread* rt, VulkanContext* context,
+                         MemoryArena* renderer_arena);
+// Renders everything already submitted, then joins the thread
+void render_thread_stop(RenderThread* rt);
+
+// Blocks until the render thread is done with a push buffer, returns it empty
+RenderFrame* render_thread_begin_frame(RenderThread* rt);
+void render_thread_submit_frame(RenderThread* rt, RenderFrame* frame);
+void render_thread_request_resize(RenderThread* rt, int width, int height);
@@ -1,4 +1,5 @@
 #include "vkh_renderer.h"
+#include "image.h"
 #include "SDL3/SDL_iostream.h"
 #include "SDL3/SDL_stdinc.h"
 #include "vkh_memory.h"
@@ -49,6 +50,13 @@ queue_indices get_graphics_and_present_queue_indices(VulkanContext* context,
         if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             *result.graphics = i;
         }
+
+        // Nothing is presented without a surface
+        if (context->surface == VK_NULL_HANDLE) {
+            *result.present = *result.graphics;
+            continue;
+        }
+
         uint32_t present_support;
         vkGetPhysicalDeviceSurfaceSupportKHR(
             context->physical_device, i, context->surface, &present_support);
@@ -114,58 +122,168 @@ my_file readfile(const char* path, MemoryArena* arena) {
     return mf;
 }
 
+const char* PIPELINE_CACHE_PATH = "./build/vkh_pipeline_cache.bin";
+
+// A cache from another driver or GPU is at best useless and some drivers
+// crash on it instead of rejecting it, so check the header ourselves
+static bool PipelineCacheMatchesDevice(VulkanContext* context,
+                                       const void* data, size_t size) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    SDL_memcpy(&header, data, sizeof(header));
+
+    const VkPhysicalDeviceProperties& properties =
+        context->physical_device_properties2.properties;
+    return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           SDL_memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                      VK_UUID_SIZE) == 0;
+}
+
+void CreatePipelineCache(VulkanContext* context) {
+    size_t size = 0;
+    void* data = SDL_LoadFile(PIPELINE_CACHE_PATH, &size);
+
+    VkPipelineCacheCreateInfo cache_info{};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (data && PipelineCacheMatchesDevice(context, data, size)) {
+        cache_info.initialDataSize = size;
+        cache_info.pInitialData = data;
+        fprintf(stderr, "Pipeline cache: loaded %zu bytes from %s\n", size,
+                PIPELINE_CACHE_PATH);
+    } else if (data) {
+        fprintf(stderr, "Pipeline cache: %s is for another device, ignored\n",
+                PIPELINE_CACHE_PATH);
+    } else {
+        fprintf(stderr, "Pipeline cache: starting cold\n");
+    }
+
+    VkResult res = vkCreatePipelineCache(context->device, &cache_info, 0,
+                                         &context->pipeline_cache);
+    if (res != VK_SUCCESS && cache_info.pInitialData) {
+        // Matching header, broken body, start over without it
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = 0;
+        res = vkCreatePipelineCache(context->device, &cache_info, 0,
+                                    &context->pipeline_cache);
+    }
+    assert(res == VK_SUCCESS);
+    SDL_free(data);
+}
+
+// Written to a temporary file and renamed, a crash mid-write never leaves
+// a truncated cache behind
+void SavePipelineCache(VulkanContext* context, MemoryArena* arena) {
+    size_t size = 0;
+    VkResult res = vkGetPipelineCacheData(context->device,
+                                          context->pipeline_cache, &size, 0);
+    if (res != VK_SUCCESS || size == 0) {
+        return;
+    }
+
+    TempArenaScope scope(arena);
+    void* data = arena_push(arena, size);
+    res = vkGetPipelineCacheData(context->device, context->pipeline_cache,
+                                 &size, data);
+    if (res != VK_SUCCESS) {
+        return;
+    }
+
+    char temp_path[256];
+    SDL_snprintf(temp_path, sizeof(temp_path), "%s.tmp", PIPELINE_CACHE_PATH);
+    if (SDL_SaveFile(temp_path, data, size) &&
+        SDL_RenamePath(temp_path, PIPELINE_CACHE_PATH)) {
+        fprintf(stderr, "Pipeline cache: saved %zu bytes\n", size);
+    } else {
+        fprintf(stderr, "Pipeline cache: failed to save: %s\n",
+                SDL_GetError());
+    }
+}
+
 void CreateDescriptorSetLayout(VulkanContext* context, MemoryArena* arena) {
     VkDescriptorSetLayoutBinding uboLayoutBinding{};
     uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount = 1;
 
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
+    // Binding 1 is the atlas, binding 2 the bindless texture array. Only
+    // one of them exists, depending on the device.
+    VkDescriptorSetLayoutBinding textureLayoutBinding{};
+    textureLayoutBinding.descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    textureLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    if (context->bindless_supported) {
+        textureLayoutBinding.binding = 2;
+        textureLayoutBinding.descriptorCount = BINDLESS_TEXTURE_CAPACITY;
+    } else {
+        textureLayoutBinding.binding = 1;
+        textureLayoutBinding.descriptorCount = 1;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[] = {uboLayoutBinding,
+                                               textureLayoutBinding};
+
+    // Slots without a texture are never written
+    VkDescriptorBindingFlags bindingFlags[] = {
+        0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT};
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = ArrayCount(bindingFlags);
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    layoutInfo.pNext =
+        context->bindless_supported ? &bindingFlagsInfo : nullptr;
+    layoutInfo.bindingCount = ArrayCount(bindings);
+    layoutInfo.pBindings = bindings;
 
     vkCreateDescriptorSetLayout(context->device, &layoutInfo, nullptr,
                                 &context->descriptor_set_layout);
 }
 
-void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
+// Returns VK_NULL_HANDLE when the SPIR-V file is missing
+VkShaderModule CreateShaderModule(VulkanContext* context, const char* path,
+                                  MemoryArena* arena) {
+    SDL_PathInfo info;
+    if (!SDL_GetPathInfo(path, &info)) {
+        fprintf(stderr, "Shader not found: %s\n", path);
+        return VK_NULL_HANDLE;
+    }
+
     temp_arena tmp = begin_temp_arena(arena);
 
-#if SDL_PLATFORM_WINDOWS
-    const char* vert_shader_path = ".\\shaders\\heart.vert.spv";
-    const char* frag_shader_path = ".\\shaders\\heart.frag.spv";
-#else
-    const char *vert_shader_path = "./shaders/heart.vert.spv";
-    const char *frag_shader_path = "./shaders/heart.frag.spv";
-#endif
+    my_file shader_mf = readfile(path, arena);
 
-    my_file vert_shader_mf = readfile(vert_shader_path, arena);
-    my_file frag_shader_mf = readfile(frag_shader_path, arena);
+    VkShaderModuleCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = shader_mf.size;
+    createInfo.pCode = (uint32_t*)shader_mf.mem;
 
-    VkShaderModule vert_shader_module;
-    VkShaderModule frag_shader_module;
-    {
-        VkShaderModuleCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = vert_shader_mf.size;
-        createInfo.pCode = (uint32_t*)vert_shader_mf.mem;
-        VkResult res = vkCreateShaderModule(context->device, &createInfo,
-                                            nullptr, &vert_shader_module);
-        assert(res == VK_SUCCESS);
-    }
-    {
-        VkShaderModuleCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = frag_shader_mf.size;
-        createInfo.pCode = (uint32_t*)frag_shader_mf.mem;
-        VkResult res = vkCreateShaderModule(context->device, &createInfo,
-                                            nullptr, &frag_shader_module);
-        assert(res == VK_SUCCESS);
-    }
+    VkShaderModule shader_module;
+    VkResult res = vkCreateShaderModule(context->device, &createInfo, nullptr,
+                                        &shader_module);
+    assert(res == VK_SUCCESS);
+
+    end_temp_arena(&tmp);
+    return shader_module;
+}
 
+// With alpha_blend fragments are blended over the target by their
+// (straight) alpha, otherwise they replace it
+VkPipeline CreatePipeline(
+    VulkanContext* context, VkShaderModule vert_shader_module,
+    VkShaderModule frag_shader_module,
+    const VkPipelineVertexInputStateCreateInfo* vertexInputInfo,
+    bool alpha_blend) {
     VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
     vertShaderStageInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -192,45 +310,6 @@ void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
         .pDynamicStates = dynamicStates,
     };
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-    VkVertexInputBindingDescription bindingDescriptions[2] = {};
-
-    bindingDescriptions[0].binding = 0;
-    bindingDescriptions[0].stride = sizeof(Vertex2D);
-    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    bindingDescriptions[1].binding = 1;
-    bindingDescriptions[1].stride = sizeof(InstanceData);
-    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
-
-    VkVertexInputAttributeDescription attributeDescriptions[6] = {};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex2D, pos);
-
-    for (int i = 0; i < 4; i++) {
-        attributeDescriptions[1 + i].binding = 1;
-        attributeDescriptions[1 + i].location = 1 + i;
-        attributeDescriptions[1 + i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        attributeDescriptions[1 + i].offset = i * sizeof(float) * 4;
-    }
-
-    attributeDescriptions[5].binding = 1;
-    attributeDescriptions[5].location = 5;
-    attributeDescriptions[5].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[5].offset = sizeof(float) * 16;
-
-    vertexInputInfo.vertexBindingDescriptionCount = sizeof(bindingDescriptions) / sizeof(bindingDescriptions[0]);
-    vertexInputInfo.vertexAttributeDescriptionCount =
-        sizeof(attributeDescriptions) / sizeof(attributeDescriptions[0]);
-    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
-
     VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
     inputAssembly.sType =
         VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -277,7 +356,15 @@ void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
     colorBlendAttachment.colorWriteMask =
         VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.blendEnable = alpha_blend ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor =
+        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor =
+        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
     VkPipelineColorBlendStateCreateInfo colorBlending{};
     colorBlending.sType =
@@ -286,15 +373,6 @@ void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
     colorBlending.attachmentCount = 1;
     colorBlending.pAttachments = &colorBlendAttachment;
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &context->descriptor_set_layout;
-
-    VkResult res = vkCreatePipelineLayout(context->device, &pipelineLayoutInfo,
-                                          0, &context->pipeline_layout);
-    assert(res == VK_SUCCESS);
-
     VkPipelineRenderingCreateInfoKHR pipeline_create{
         VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR};
     pipeline_create.pNext = VK_NULL_HANDLE;
@@ -308,7 +386,7 @@ void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
     pipelineInfo.stageCount = 2;
     pipelineInfo.pStages = shaderStages;
 
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pVertexInputState = vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
@@ -320,15 +398,238 @@ void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
     pipelineInfo.renderPass = VK_NULL_HANDLE;
     pipelineInfo.subpass = 0;
 
-    res = vkCreateGraphicsPipelines(context->device, VK_NULL_HANDLE, 1,
-                                    &pipelineInfo, nullptr,
-                                    &context->graphics_pipeline);
+    VkPipeline pipeline;
+    VkResult res = vkCreateGraphicsPipelines(context->device,
+                                             context->pipeline_cache, 1,
+                                             &pipelineInfo, nullptr, &pipeline);
+    assert(res == VK_SUCCESS);
+
+    return pipeline;
+}
+
+// Draws the static unit meshes from binding 0, instanced by binding 1. The
+// instance layout must start with the InstanceData2D fields, instance_stride
+// lets bigger structs (e.g. GpuParticle) be drawn in place.
+VkPipeline CreateInstancedPipeline(VulkanContext* context,
+                                   VkShaderModule vert_shader_module,
+                                   VkShaderModule frag_shader_module,
+                                   uint32_t instance_stride) {
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkVertexInputBindingDescription bindingDescriptions[2] = {};
+
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(Vertex2D);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = instance_stride;
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    VkVertexInputAttributeDescription attributeDescriptions[4] = {};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex2D, pos);
+
+    attributeDescriptions[1].binding = 1;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(InstanceData2D, position);
+
+    attributeDescriptions[2].binding = 1;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(InstanceData2D, size);
+
+    attributeDescriptions[3].binding = 1;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[3].offset = offsetof(InstanceData2D, color);
+
+    vertexInputInfo.vertexBindingDescriptionCount = sizeof(bindingDescriptions) / sizeof(bindingDescriptions[0]);
+    vertexInputInfo.vertexAttributeDescriptionCount =
+        sizeof(attributeDescriptions) / sizeof(attributeDescriptions[0]);
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+    return CreatePipeline(context, vert_shader_module, frag_shader_module,
+                          &vertexInputInfo, false);
+}
+
+// Plain coloured triangle list out of the per-frame dynamic vertex region.
+VkPipeline CreateTrianglePipeline(VulkanContext* context,
+                                  VkShaderModule vert_shader_module,
+                                  VkShaderModule frag_shader_module) {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(ColorVertex2D);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription attributeDescriptions[2] = {};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(ColorVertex2D, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[1].offset = offsetof(ColorVertex2D, color);
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount =
+        sizeof(attributeDescriptions) / sizeof(attributeDescriptions[0]);
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+    return CreatePipeline(context, vert_shader_module, frag_shader_module,
+                          &vertexInputInfo, false);
+}
+
+// Unit quad at binding 0, SpriteInstance2D at binding 1. Sampled from the
+// atlas or the bindless array, depending on the fragment shader, and alpha
+// blended.
+VkPipeline CreateSpritePipeline(VulkanContext* context,
+                                VkShaderModule vert_shader_module,
+                                VkShaderModule frag_shader_module) {
+    VkVertexInputBindingDescription bindingDescriptions[2] = {};
+
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(Vertex2D);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    bindingDescriptions[1].binding = 1;
+    bindingDescriptions[1].stride = sizeof(SpriteInstance2D);
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    VkVertexInputAttributeDescription attributeDescriptions[6] = {};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex2D, pos);
+
+    attributeDescriptions[1].binding = 1;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(SpriteInstance2D, position);
+
+    attributeDescriptions[2].binding = 1;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(SpriteInstance2D, size);
+
+    attributeDescriptions[3].binding = 1;
+    attributeDescriptions[3].location = 3;
+    attributeDescriptions[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[3].offset = offsetof(SpriteInstance2D, color);
+
+    attributeDescriptions[4].binding = 1;
+    attributeDescriptions[4].location = 4;
+    attributeDescriptions[4].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributeDescriptions[4].offset = offsetof(SpriteInstance2D, uv_rect);
+
+    attributeDescriptions[5].binding = 1;
+    attributeDescriptions[5].location = 5;
+    attributeDescriptions[5].format = VK_FORMAT_R32_UINT;
+    attributeDescriptions[5].offset = offsetof(SpriteInstance2D, texture);
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount =
+        ArrayCount(bindingDescriptions);
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
+    vertexInputInfo.vertexAttributeDescriptionCount =
+        ArrayCount(attributeDescriptions);
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+    return CreatePipeline(context, vert_shader_module, frag_shader_module,
+                          &vertexInputInfo, true);
+}
+
+void CreateGraphicsPipeline(VulkanContext* context, MemoryArena* arena) {
+#if SDL_PLATFORM_WINDOWS
+    const char* vert_shader_path = ".\\shaders\\heart.vert.spv";
+    const char* frag_shader_path = ".\\shaders\\heart.frag.spv";
+    const char* triangle_vert_shader_path = ".\\shaders\\triangle.vert.spv";
+    const char* sprite_vert_shader_path = ".\\shaders\\sprite.vert.spv";
+    const char* sprite_frag_shader_path = ".\\shaders\\sprite.frag.spv";
+    const char* sprite_bindless_frag_shader_path =
+        ".\\shaders\\sprite_bindless.frag.spv";
+#else
+    const char *vert_shader_path = "./shaders/heart.vert.spv";
+    const char *frag_shader_path = "./shaders/heart.frag.spv";
+    const char *triangle_vert_shader_path = "./shaders/triangle.vert.spv";
+    const char *sprite_vert_shader_path = "./shaders/sprite.vert.spv";
+    const char *sprite_frag_shader_path = "./shaders/sprite.frag.spv";
+    const char *sprite_bindless_frag_shader_path =
+        "./shaders/sprite_bindless.frag.spv";
+#endif
+
+    VkShaderModule vert_shader_module =
+        CreateShaderModule(context, vert_shader_path, arena);
+    VkShaderModule frag_shader_module =
+        CreateShaderModule(context, frag_shader_path, arena);
+    assert(vert_shader_module && frag_shader_module);
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(ViewPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &context->descriptor_set_layout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push_constant_range;
+
+    VkResult res = vkCreatePipelineLayout(context->device, &pipelineLayoutInfo,
+                                          0, &context->pipeline_layout);
     assert(res == VK_SUCCESS);
 
+    context->pipelines[PIPELINE_INSTANCED] =
+        CreateInstancedPipeline(context, vert_shader_module,
+                                frag_shader_module, sizeof(InstanceData2D));
+
+    // GPU particles are drawn straight out of their storage buffer
+    context->pipelines[PIPELINE_GPU_PARTICLES] =
+        CreateInstancedPipeline(context, vert_shader_module,
+                                frag_shader_module, sizeof(GpuParticle));
+
+    VkShaderModule triangle_vert_shader_module =
+        CreateShaderModule(context, triangle_vert_shader_path, arena);
+    assert(triangle_vert_shader_module);
+
+    context->pipelines[PIPELINE_TRIANGLES] = CreateTrianglePipeline(
+        context, triangle_vert_shader_module, frag_shader_module);
+
+    VkShaderModule sprite_vert_shader_module =
+        CreateShaderModule(context, sprite_vert_shader_path, arena);
+    VkShaderModule sprite_frag_shader_module = CreateShaderModule(
+        context,
+        context->bindless_supported ? sprite_bindless_frag_shader_path
+                                    : sprite_frag_shader_path,
+        arena);
+    assert(sprite_vert_shader_module && sprite_frag_shader_module);
+
+    context->pipelines[PIPELINE_SPRITES] = CreateSpritePipeline(
+        context, sprite_vert_shader_module, sprite_frag_shader_module);
+
+    vkDestroyShaderModule(context->device, sprite_vert_shader_module, 0);
+    vkDestroyShaderModule(context->device, sprite_frag_shader_module, 0);
+    vkDestroyShaderModule(context->device, triangle_vert_shader_module, 0);
     vkDestroyShaderModule(context->device, vert_shader_module, 0);
     vkDestroyShaderModule(context->device, frag_shader_module, 0);
-
-    end_temp_arena(&tmp);
 }
 
 void CreateSwapchain(VulkanContext* context, MemoryArena* parent_arena) {
@@ -558,8 +859,52 @@ uint32_t findMemoryType(VkPhysicalDevice phyical_devices, uint32_t typeFilter,
     return -1;
 }
 
-void CopyBuffer(VulkanContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer,
-                VkDeviceSize size, VkDeviceSize dstOffset) {
+void TransitionImageLayout(VulkanContext* context, VkCommandBuffer cmd,
+                           VkImage image, VkImageLayout oldLayout,
+                           VkImageLayout newLayout,
+                           VkAccessFlags2 srcAccessMask,
+                           VkAccessFlags2 dstAccessMask,
+                           VkPipelineStageFlags2 srcStageMask,
+                           VkPipelineStageFlags2 dstStageMask) {
+    VkImageMemoryBarrier2KHR image_barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+
+        .srcStageMask = srcStageMask,
+        .srcAccessMask = srcAccessMask,
+        .dstStageMask = dstStageMask,
+        .dstAccessMask = dstAccessMask,
+
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+
+        .image = image,
+
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .dependencyFlags = 0,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &image_barrier,
+    };
+
+    context->func_table.vkCmdPipelineBarrier2KHR(cmd, &dependency_info);
+}
+
+// Init time helpers, submitting waits for the whole graphics queue
+VkCommandBuffer BeginSingleTimeCommands(VulkanContext* context) {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -575,12 +920,11 @@ void CopyBuffer(VulkanContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer,
 
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-    VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0;
-    copyRegion.dstOffset = dstOffset;
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    return commandBuffer;
+}
 
+void EndSingleTimeCommands(VulkanContext* context,
+                           VkCommandBuffer commandBuffer) {
     vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
@@ -588,6 +932,8 @@ void CopyBuffer(VulkanContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer,
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
+    PROFILE_SCOPE("EndSingleTimeCommands");
+
     vkQueueSubmit(context->graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(context->graphics_queue);
 
@@ -595,110 +941,708 @@ void CopyBuffer(VulkanContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer,
                          &commandBuffer);
 }
 
-void CreateBuffer(VulkanContext* context, VkDeviceSize size,
-                  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+void CopyBuffer(VulkanContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer,
+                VkDeviceSize size, VkDeviceSize dstOffset) {
+    VkCommandBuffer commandBuffer = BeginSingleTimeCommands(context);
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+    EndSingleTimeCommands(context, commandBuffer);
+}
+
+void CreateBuffer(VulkanContext* context, VkDeviceSize size,
+                  VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                  VkBuffer& buffer, GpuAllocation& allocation) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     vkCreateBuffer(context->device, &bufferInfo, nullptr, &buffer);
 
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(context->device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
-        context->physical_device, memRequirements.memoryTypeBits, properties);
+    bool allocated = gpu_alloc(context->gpu_allocator, memRequirements,
+                               properties, GPU_RESOURCE_LINEAR, &allocation);
+    assert(allocated);
 
-    vkAllocateMemory(context->device, &allocInfo, nullptr, &bufferMemory);
+    vkBindBufferMemory(context->device, buffer, allocation.memory,
+                       allocation.offset);
+}
 
-    vkBindBufferMemory(context->device, buffer, bufferMemory, 0);
+void DestroyBuffer(VulkanContext* context, VkBuffer& buffer,
+                   GpuAllocation& allocation) {
+    vkDestroyBuffer(context->device, buffer, nullptr);
+    gpu_free(context->gpu_allocator, &allocation);
+    buffer = VK_NULL_HANDLE;
 }
 
 void CreateDeviceStagingBuffer(VulkanContext* context,
                                MemoryArena* renderer_arena) {
-    CreateBuffer(context, context->STAGING_BUFFER_SIZE,
+    context->staging_frame_capacity = context->STAGING_FRAME_SIZE;
+    context->staging_buffer_size =
+        context->STAGING_FRAME_SIZE * context->MAX_FRAMES_IN_FLIGHT;
+    CreateBuffer(context, context->staging_buffer_size,
                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 context->staging_buffer, context->staging_buffer_memory);
+                 context->staging_buffer, context->staging_buffer_allocation);
+    context->staging_buffer_mapped = context->staging_buffer_allocation.mapped;
+
+    context->staging_frame_used = (VkDeviceSize*)arena_push(
+        renderer_arena, sizeof(VkDeviceSize) * context->MAX_FRAMES_IN_FLIGHT);
+    context->pending_copies = (PendingCopy**)arena_push(
+        renderer_arena, sizeof(PendingCopy*) * context->MAX_FRAMES_IN_FLIGHT);
+    context->pending_copy_count = (uint32_t*)arena_push(
+        renderer_arena, sizeof(uint32_t) * context->MAX_FRAMES_IN_FLIGHT);
+
+    for (uint32_t i = 0; i < context->MAX_FRAMES_IN_FLIGHT; i++) {
+        context->staging_frame_used[i] = 0;
+        context->pending_copies[i] = (PendingCopy*)arena_push(
+            renderer_arena, sizeof(PendingCopy) * context->MAX_PENDING_COPIES);
+        context->pending_copy_count[i] = 0;
+    }
+}
+
+// Must only be called once the frame's in_flight_fence has been waited on.
+void ResetFrameStaging(VulkanContext* context, uint32_t frame) {
+    context->staging_frame_used[frame] = 0;
+    context->pending_copy_count[frame] = 0;
+}
+
+// Returns a pointer into the mapped staging slice of `frame`, the offset of
+// that memory inside staging_buffer is written to `staging_offset`.
+uint8_t* StagingPush(VulkanContext* context, uint32_t frame, VkDeviceSize size,
+                     VkDeviceSize* staging_offset) {
+    // Keep every copy source 16 byte aligned, plenty for vkCmdCopyBuffer
+    VkDeviceSize used = (context->staging_frame_used[frame] + 15) & ~15ull;
+    assert(used + size <= context->staging_frame_capacity);
 
-    context->staging_buffer_mapped =
-        arena_push(renderer_arena, context->STAGING_BUFFER_SIZE);
+    *staging_offset = frame * context->staging_frame_capacity + used;
+    context->staging_frame_used[frame] = used + size;
 
-    vkMapMemory(context->device, context->staging_buffer_memory, 0,
-                context->STAGING_BUFFER_SIZE, 0,
-                &context->staging_buffer_mapped);
+    return (uint8_t*)context->staging_buffer_mapped + *staging_offset;
 }
 
-void CreateDeviceMemoryBuffer(VulkanContext* context) {
-    VkDeviceSize bufferSize = context->MAX_DEVICE_MEMORY_ALLOCATION_SIZE;
+// Records a staging -> dst copy that will be executed at the start of
+// `frame`'s command buffer.
+void QueueStagingCopy(VulkanContext* context, uint32_t frame,
+                      VkDeviceSize staging_offset, VkDeviceSize size,
+                      VkBuffer dst, VkDeviceSize dst_offset) {
+    assert(context->pending_copy_count[frame] < context->MAX_PENDING_COPIES);
+
+    PendingCopy* copy =
+        &context->pending_copies[frame][context->pending_copy_count[frame]++];
+    copy->dst = dst;
+    copy->region.srcOffset = staging_offset;
+    copy->region.dstOffset = dst_offset;
+    copy->region.size = size;
+}
+
+void QueueBufferUpload(VulkanContext* context, uint32_t frame,
+                       const void* data, VkDeviceSize size, VkBuffer dst,
+                       VkDeviceSize dst_offset) {
+    VkDeviceSize staging_offset;
+    uint8_t* mapped = StagingPush(context, frame, size, &staging_offset);
+    memcpy(mapped, data, (size_t)size);
+
+    QueueStagingCopy(context, frame, staging_offset, size, dst, dst_offset);
+}
+
+void RecordPendingCopies(VulkanContext* context, VkCommandBuffer cmd,
+                         uint32_t frame) {
+    uint32_t copy_count = context->pending_copy_count[frame];
+    if (copy_count == 0) {
+        return;
+    }
+
+    // NOTE: Copies only target this frame's slices, whose last reader was
+    // this frame index's previous submission, already fenced. No barrier
+    // against the frames still in flight is needed before writing.
+    for (uint32_t i = 0; i < copy_count; i++) {
+        PendingCopy* copy = &context->pending_copies[frame][i];
+        vkCmdCopyBuffer(cmd, context->staging_buffer, copy->dst, 1,
+                        &copy->region);
+    }
+
+    VkMemoryBarrier2 after_copy{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+                        VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+        .dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT |
+                         VK_ACCESS_2_INDEX_READ_BIT,
+    };
+
+    VkDependencyInfo after_dependency{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &after_copy,
+    };
+
+    context->func_table.vkCmdPipelineBarrier2KHR(cmd, &after_dependency);
+}
+
+void CreateFrameBuffers(VulkanContext* context, MemoryArena* arena) {
+    uint32_t frames = context->MAX_FRAMES_IN_FLIGHT;
+    context->frame_instance_buffers =
+        (VkBuffer*)arena_push(arena, sizeof(VkBuffer) * frames);
+    context->frame_instance_allocations =
+        (GpuAllocation*)arena_push(arena, sizeof(GpuAllocation) * frames);
+    context->frame_vertex_buffers =
+        (VkBuffer*)arena_push(arena, sizeof(VkBuffer) * frames);
+    context->frame_vertex_allocations =
+        (GpuAllocation*)arena_push(arena, sizeof(GpuAllocation) * frames);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        CreateBuffer(
+            context, context->INSTANCE_FRAME_SIZE,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            context->frame_instance_buffers[i],
+            context->frame_instance_allocations[i]);
+        CreateBuffer(
+            context, context->DYNAMIC_VERTEX_FRAME_SIZE,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            context->frame_vertex_buffers[i],
+            context->frame_vertex_allocations[i]);
+    }
+}
+
+// Set VKH_NO_DIRECT_UPLOAD to force the staging path for comparison
+void CreateDirectUploadBuffer(VulkanContext* context) {
+    context->direct_upload_supported = false;
+    if (SDL_getenv("VKH_NO_DIRECT_UPLOAD")) {
+        return;
+    }
+
+    VkDeviceSize frame_size =
+        context->INSTANCE_FRAME_SIZE + context->DYNAMIC_VERTEX_FRAME_SIZE;
 
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = bufferSize;
-    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                       VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                       VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.size = frame_size * context->MAX_FRAMES_IN_FLIGHT;
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    vkCreateBuffer(context->device, &bufferInfo, nullptr,
-                   &context->device_memory_buffer);
+    VkResult res = vkCreateBuffer(context->device, &bufferInfo, nullptr,
+                                  &context->direct_buffer);
+    assert(res == VK_SUCCESS);
 
     VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(
-        context->device, context->device_memory_buffer, &memRequirements);
+    vkGetBufferMemoryRequirements(context->device, context->direct_buffer,
+                                  &memRequirements);
+
+    uint32_t memory_type = findMemoryType(
+        context->physical_device, memRequirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    // Without ReBAR the host visible device heap is a 256 MB window other
+    // drivers and apps share, don't take more than half of it
+    bool fits = false;
+    if (memory_type != UINT32_MAX) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(context->physical_device,
+                                            &memProperties);
+        uint32_t heap = memProperties.memoryTypes[memory_type].heapIndex;
+        fits = memRequirements.size <= memProperties.memoryHeaps[heap].size / 2;
+    }
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(context->physical_device, memRequirements.memoryTypeBits,
-                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (fits) {
+        fits = gpu_alloc(context->gpu_allocator, memRequirements,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         GPU_RESOURCE_LINEAR,
+                         &context->direct_buffer_allocation);
+    }
+
+    if (!fits) {
+        vkDestroyBuffer(context->device, context->direct_buffer, 0);
+        context->direct_buffer = VK_NULL_HANDLE;
+        fprintf(stderr, "Direct upload unavailable, using staging copies\n");
+        return;
+    }
+
+    vkBindBufferMemory(context->device, context->direct_buffer,
+                       context->direct_buffer_allocation.memory,
+                       context->direct_buffer_allocation.offset);
+    context->direct_buffer_mapped =
+        (uint8_t*)context->direct_buffer_allocation.mapped;
+
+    context->direct_upload_supported = true;
+    fprintf(stderr, "Direct upload into host visible device memory\n");
+}
+
+void CreateRetiredBufferLists(VulkanContext* context, MemoryArena* arena) {
+    uint32_t frames = context->MAX_FRAMES_IN_FLIGHT;
+    context->retired_buffers =
+        (RetiredBuffer**)arena_push(arena, sizeof(RetiredBuffer*) * frames);
+    context->retired_buffer_count =
+        (uint32_t*)arena_push(arena, sizeof(uint32_t) * frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        context->retired_buffers[i] = (RetiredBuffer*)arena_push(
+            arena, sizeof(RetiredBuffer) * context->MAX_RETIRED_BUFFERS);
+        context->retired_buffer_count[i] = 0;
+    }
+}
+
+// The buffer is destroyed the next time `frame` starts, once its fence
+// says no submission reads from it anymore
+void RetireBuffer(VulkanContext* context, uint32_t frame, VkBuffer buffer,
+                  GpuAllocation allocation) {
+    assert(context->retired_buffer_count[frame] < context->MAX_RETIRED_BUFFERS);
+    RetiredBuffer* retired =
+        &context->retired_buffers[frame][context->retired_buffer_count[frame]++];
+    retired->buffer = buffer;
+    retired->allocation = allocation;
+}
+
+// Must only be called once the frame's in_flight_fence has been waited on.
+void FreeRetiredBuffers(VulkanContext* context, uint32_t frame) {
+    for (uint32_t i = 0; i < context->retired_buffer_count[frame]; i++) {
+        RetiredBuffer* retired = &context->retired_buffers[frame][i];
+        DestroyBuffer(context, retired->buffer, retired->allocation);
+    }
+    context->retired_buffer_count[frame] = 0;
+}
+
+// The buffers are freed once no frame in flight can draw with them
+void RemoveStaticMesh(VulkanContext* context, uint32_t frame, StaticMeshId id) {
+    StaticMesh* mesh = &context->static_meshes[id];
+    if (mesh->vertex_buffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    RetireBuffer(context, frame, mesh->vertex_buffer, mesh->vertex_allocation);
+    RetireBuffer(context, frame, mesh->index_buffer, mesh->index_allocation);
+    mesh->vertex_buffer = VK_NULL_HANDLE;
+    mesh->index_buffer = VK_NULL_HANDLE;
+    mesh->index_count = 0;
+}
 
-    vkAllocateMemory(context->device, &allocInfo, nullptr,
-                     &context->device_memory_buffer_memory);
+// Replaces any mesh already stored under id. Like every staging upload it
+// must happen while `frame` is built, after its ResetFrameStaging and
+// before RecordCommandBuffer, which copies the data in ahead of the draws.
+void AddStaticMesh(VulkanContext* context, uint32_t frame, StaticMeshId id,
+                   const Vertex2D* vertices, uint32_t vertex_count,
+                   const uint32_t* indices, uint32_t index_count) {
+    VkDeviceSize vertices_size = sizeof(Vertex2D) * vertex_count;
+    VkDeviceSize indices_size = sizeof(uint32_t) * index_count;
+
+    RemoveStaticMesh(context, frame, id);
+
+    StaticMesh* mesh = &context->static_meshes[id];
+    mesh->index_count = index_count;
+
+    CreateBuffer(context, vertices_size,
+                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh->vertex_buffer,
+                 mesh->vertex_allocation);
+    CreateBuffer(context, indices_size,
+                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh->index_buffer,
+                 mesh->index_allocation);
+
+    QueueBufferUpload(context, frame, vertices, vertices_size,
+                      mesh->vertex_buffer, 0);
+    QueueBufferUpload(context, frame, indices, indices_size,
+                      mesh->index_buffer, 0);
+}
 
-    vkBindBufferMemory(context->device, context->device_memory_buffer,
-                       context->device_memory_buffer_memory, 0);
+// Outside the frame loop, e.g. at init, runs the copies queued on `frame`
+// right away so its first ResetFrameStaging doesn't drop them
+void FlushFrameStaging(VulkanContext* context, uint32_t frame) {
+    VkCommandBuffer cmd = BeginSingleTimeCommands(context);
+    RecordPendingCopies(context, cmd, frame);
+    EndSingleTimeCommands(context, cmd);
+    ResetFrameStaging(context, frame);
 }
 
-void CreateVertexBuffer(VulkanContext* context) {
-    const std::vector<Vertex2D> vertices = {
+void UploadStaticGeometry(VulkanContext* context) {
+    const Vertex2D quad_vertices[] = {
         {1.0f, 0.0f},
         {0.0f, 0.0f},
         {0.0f, 1.0f},
         {1.0f, 1.0f},
     };
+    const uint32_t quad_indices[] = {0, 1, 2, 2, 3, 0};
+
+    const Vertex2D triangle_vertices[] = {
+        {0.0f, 0.0f},
+        {1.0f, 0.0f},
+        {0.0f, 1.0f},
+    };
+    const uint32_t triangle_indices[] = {0, 1, 2};
+
+    // Queued on frame 0 and flushed, nothing is in flight yet
+    AddStaticMesh(context, 0, MESH_QUAD, quad_vertices,
+                  ArrayCount(quad_vertices), quad_indices,
+                  ArrayCount(quad_indices));
+    AddStaticMesh(context, 0, MESH_TRIANGLE, triangle_vertices,
+                  ArrayCount(triangle_vertices), triangle_indices,
+                  ArrayCount(triangle_indices));
+    FlushFrameStaging(context, 0);
+}
+
+const char* SPRITE_PATHS[SPRITE_MAX] = {
+    "./assets/tile.bmp",
+    "./assets/heart.bmp",
+};
+
+// Texels left empty around every sprite, so filtering never reaches into
+// a neighbour
+const uint32_t ATLAS_PADDING = 1;
+
+// Magenta and black checks, a missing image is obvious on screen
+static Image MissingSpriteImage(MemoryArena* arena) {
+    const uint32_t size = 16;
+
+    Image image = {};
+    image.width = size;
+    image.height = size;
+    image.channels = 3;
+    image.data = (uint32_t*)arena_push(arena, size * size * sizeof(uint32_t));
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            bool magenta = ((x / 4) ^ (y / 4)) & 1;
+            image.data[y * size + x] = magenta ? 0xFFFF00FF : 0xFF000000;
+        }
+    }
+    return image;
+}
+
+// Shelf packing: images go left to right, tallest first, and a new shelf
+// starts below the tallest image of the current one. Returns false when
+// they don't fit into width x height.
+static bool PackAtlas(const Image* images, const uint32_t* order,
+                      uint32_t count, uint32_t width, uint32_t height,
+                      AtlasRegion* regions) {
+    uint32_t shelf_y = ATLAS_PADDING;
+    uint32_t shelf_height = 0;
+    uint32_t x = ATLAS_PADDING;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const Image* image = &images[order[i]];
+        uint32_t w = (uint32_t)image->width;
+        uint32_t h = (uint32_t)image->height;
+
+        if (x + w + ATLAS_PADDING > width) {
+            shelf_y += shelf_height + ATLAS_PADDING;
+            shelf_height = 0;
+            x = ATLAS_PADDING;
+        }
+        if (x + w + ATLAS_PADDING > width ||
+            shelf_y + h + ATLAS_PADDING > height) {
+            return false;
+        }
+
+        regions[order[i]] = {x, shelf_y, w, h};
+        x += w + ATLAS_PADDING;
+        shelf_height = SDL_max(shelf_height, h);
+    }
+    return true;
+}
 
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+// Missing files get the placeholder, the renderer always has SPRITE_MAX
+// images
+static void LoadSpriteImages(Image* images, MemoryArena* arena) {
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        images[i] = loadBMP(SPRITE_PATHS[i], arena);
+        if (!images[i].data) {
+            fprintf(stderr, "Sprite %s missing, using a placeholder\n",
+                    SPRITE_PATHS[i]);
+            images[i] = MissingSpriteImage(arena);
+        }
+    }
+}
 
-    assert(bufferSize <= context->STAGING_BUFFER_SIZE);
-    assert(context->vertex_buffer_size + bufferSize <=
-           context->MAX_VERTEX_BUFFER_SIZE);
-    context->vertex_buffer_size += bufferSize;
+// RGBA8 image in device local memory that transfers can write and shaders
+// sample, with a view of its single mip
+static void CreateSampledImage(VulkanContext* context, uint32_t width,
+                               uint32_t height, VkImage* image,
+                               VkImageView* view, GpuAllocation* allocation) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent = {width, height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage =
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult res = vkCreateImage(context->device, &imageInfo, nullptr, image);
+    assert(res == VK_SUCCESS);
 
-    memcpy(context->staging_buffer_mapped, vertices.data(), (size_t)bufferSize);
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(context->device, *image, &memRequirements);
+    bool allocated = gpu_alloc(context->gpu_allocator, memRequirements,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               GPU_RESOURCE_OPTIMAL, allocation);
+    assert(allocated);
+    vkBindImageMemory(context->device, *image, allocation->memory,
+                      allocation->offset);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = *image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    res = vkCreateImageView(context->device, &viewInfo, nullptr, view);
+    assert(res == VK_SUCCESS);
+}
 
-    CopyBuffer(context, context->staging_buffer, context->device_memory_buffer,
-               bufferSize, context->vertex_buffer_offset);
+static VkSampler CreateSpriteSampler(VulkanContext* context) {
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.maxLod = 0.0f;
+
+    VkSampler sampler;
+    VkResult res =
+        vkCreateSampler(context->device, &samplerInfo, nullptr, &sampler);
+    assert(res == VK_SUCCESS);
+    return sampler;
+}
+
+// Packs the sprites into the smallest square power of two atlas that fits
+// and uploads them through the staging buffer in one submit. Init time
+// only, the copy goes through the start of the staging ring.
+void CreateSpriteAtlas(VulkanContext* context, const Image* images) {
+    TextureAtlas* atlas = &context->atlas;
+
+    // Insertion sort by height, tallest first
+    uint32_t order[SPRITE_MAX];
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        uint32_t j = i;
+        for (; j > 0 && images[order[j - 1]].height < images[i].height; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    uint32_t max_size = context->physical_device_properties2.properties
+                            .limits.maxImageDimension2D;
+    uint32_t size = 256;
+    while (!PackAtlas(images, order, SPRITE_MAX, size, size, atlas->regions)) {
+        size *= 2;
+        assert(size <= max_size);
+    }
+    atlas->width = size;
+    atlas->height = size;
+
+    // Half a texel in from the edges, bilinear filtering then only ever
+    // blends texels of the sprite itself
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        AtlasRegion* region = &atlas->regions[i];
+        float u0 = (region->x + 0.5f) / atlas->width;
+        float v0 = (region->y + 0.5f) / atlas->height;
+        float u1 = (region->x + region->width - 0.5f) / atlas->width;
+        float v1 = (region->y + region->height - 0.5f) / atlas->height;
+        context->sprites.uv_rects[i][0] = (uint16_t)(u0 * 65535.0f + 0.5f);
+        context->sprites.uv_rects[i][1] = (uint16_t)(v0 * 65535.0f + 0.5f);
+        context->sprites.uv_rects[i][2] = (uint16_t)(u1 * 65535.0f + 0.5f);
+        context->sprites.uv_rects[i][3] = (uint16_t)(v1 * 65535.0f + 0.5f);
+        context->sprites.textures[i] = 0;
+    }
+
+    CreateSampledImage(context, atlas->width, atlas->height, &atlas->image,
+                       &atlas->view, &atlas->allocation);
+    atlas->sampler = CreateSpriteSampler(context);
+
+    // Every sprite tightly packed in the staging buffer, one copy region
+    // each
+    VkBufferImageCopy regions[SPRITE_MAX] = {};
+    VkDeviceSize staging_used = 0;
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        AtlasRegion* region = &atlas->regions[i];
+        VkDeviceSize image_size =
+            (VkDeviceSize)region->width * region->height * sizeof(uint32_t);
+        assert(staging_used + image_size <= context->staging_buffer_size);
+
+        memcpy((uint8_t*)context->staging_buffer_mapped + staging_used,
+               images[i].data, (size_t)image_size);
+
+        regions[i].bufferOffset = staging_used;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = {(int32_t)region->x, (int32_t)region->y, 0};
+        regions[i].imageExtent = {region->width, region->height, 1};
+
+        staging_used += image_size;
+    }
+
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+
+    VkCommandBuffer cmd = BeginSingleTimeCommands(context);
+
+    TransitionImageLayout(context, cmd, atlas->image,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                          VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                          VK_PIPELINE_STAGE_2_CLEAR_BIT);
+
+    // The padding stays transparent
+    VkClearColorValue clear_color = {{0.0f, 0.0f, 0.0f, 0.0f}};
+    vkCmdClearColorImage(cmd, atlas->image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color, 1,
+                         &range);
+
+    TransitionImageLayout(context, cmd, atlas->image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                          VK_PIPELINE_STAGE_2_COPY_BIT);
+
+    vkCmdCopyBufferToImage(cmd, context->staging_buffer, atlas->image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, SPRITE_MAX,
+                           regions);
+
+    TransitionImageLayout(context, cmd, atlas->image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                          VK_PIPELINE_STAGE_2_COPY_BIT,
+                          VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    EndSingleTimeCommands(context, cmd);
+
+    fprintf(stderr, "Sprite atlas: %u sprites in %ux%u\n", SPRITE_MAX,
+            atlas->width, atlas->height);
+}
+
+// One image per sprite in the slot of its SpriteId, uploaded through the
+// start of the staging ring in one submit. Each sprite samples its whole
+// image, clamping keeps filtering inside it without an inset.
+void CreateBindlessTextures(VulkanContext* context, const Image* images) {
+    BindlessTextures* textures = &context->bindless_textures;
+    static_assert(SPRITE_MAX <= BINDLESS_TEXTURE_CAPACITY,
+                  "Sprites don't fit into the bindless array");
+
+    textures->sampler = CreateSpriteSampler(context);
+
+    VkDeviceSize offsets[SPRITE_MAX];
+    VkDeviceSize staging_used = 0;
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        uint32_t width = (uint32_t)images[i].width;
+        uint32_t height = (uint32_t)images[i].height;
+        CreateSampledImage(context, width, height, &textures->images[i],
+                           &textures->views[i], &textures->allocations[i]);
+
+        VkDeviceSize image_size =
+            (VkDeviceSize)width * height * sizeof(uint32_t);
+        assert(staging_used + image_size <= context->staging_buffer_size);
+        memcpy((uint8_t*)context->staging_buffer_mapped + staging_used,
+               images[i].data, (size_t)image_size);
+        offsets[i] = staging_used;
+        staging_used += image_size;
+
+        context->sprites.uv_rects[i][0] = 0;
+        context->sprites.uv_rects[i][1] = 0;
+        context->sprites.uv_rects[i][2] = 65535;
+        context->sprites.uv_rects[i][3] = 65535;
+        context->sprites.textures[i] = i;
+    }
+
+    VkCommandBuffer cmd = BeginSingleTimeCommands(context);
+
+    for (uint32_t i = 0; i < SPRITE_MAX; i++) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = offsets[i];
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {(uint32_t)images[i].width,
+                              (uint32_t)images[i].height, 1};
+
+        TransitionImageLayout(context, cmd, textures->images[i],
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                              VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                              VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                              VK_PIPELINE_STAGE_2_COPY_BIT);
+
+        vkCmdCopyBufferToImage(cmd, context->staging_buffer,
+                               textures->images[i],
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                               &region);
+
+        TransitionImageLayout(context, cmd, textures->images[i],
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                              VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                              VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                              VK_PIPELINE_STAGE_2_COPY_BIT,
+                              VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+    }
+
+    EndSingleTimeCommands(context, cmd);
+
+    fprintf(stderr, "Bindless textures: %u of %u slots used\n", SPRITE_MAX,
+            BINDLESS_TEXTURE_CAPACITY);
+}
+
+void CreateSpriteTextures(VulkanContext* context) {
+    ScratchScope scratch;
+
+    Image images[SPRITE_MAX];
+    LoadSpriteImages(images, scratch.arena);
+
+    if (context->bindless_supported) {
+        CreateBindlessTextures(context, images);
+    } else {
+        CreateSpriteAtlas(context, images);
+    }
 }
 
 void CreateUniformBuffers(VulkanContext* context, MemoryArena* arena) {
+    VkDeviceSize alignment = context->physical_device_properties2.properties
+                                 .limits.minUniformBufferOffsetAlignment;
+    context->draw_uniform_stride =
+        (sizeof(DrawUniforms) + alignment - 1) & ~(alignment - 1);
+    VkDeviceSize bufferSize =
+        context->draw_uniform_stride * context->MAX_DRAW_UNIFORMS;
 
-    const VkDeviceSize uniform_buffer_capacity = megabytes(256);
-    VkDeviceSize bufferSize = uniform_buffer_capacity;
+    context->draw_uniform_count = (uint32_t*)arena_push(
+        arena, sizeof(uint32_t) * context->MAX_FRAMES_IN_FLIGHT);
 
     context->uniform_buffers = (VkBuffer*)arena_push(
         arena, sizeof(VkBuffer) * context->MAX_FRAMES_IN_FLIGHT);
 
-    context->uniform_buffers_memory = (VkDeviceMemory*)arena_push(
-        arena, sizeof(VkDeviceMemory) * context->MAX_FRAMES_IN_FLIGHT);
+    context->uniform_buffer_allocations = (GpuAllocation*)arena_push(
+        arena, sizeof(GpuAllocation) * context->MAX_FRAMES_IN_FLIGHT);
 
     context->uniform_buffers_mapped = (void**)arena_push(
         arena, sizeof(void*) * context->MAX_FRAMES_IN_FLIGHT);
@@ -708,23 +1652,46 @@ void CreateUniformBuffers(VulkanContext* context, MemoryArena* arena) {
                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                      context->uniform_buffers[i],
-                     context->uniform_buffers_memory[i]);
-
-        vkMapMemory(context->device, context->uniform_buffers_memory[i], 0,
-                    bufferSize, 0, &context->uniform_buffers_mapped[i]);
+                     context->uniform_buffer_allocations[i]);
+        context->uniform_buffers_mapped[i] =
+            context->uniform_buffer_allocations[i].mapped;
+        context->draw_uniform_count[i] = 0;
     }
 }
 
+// Returns the dynamic offset to bind `uniforms` with. Only valid for the
+// frame's own command buffer, the ring slice is reused the next time round.
+uint32_t PushDrawUniforms(VulkanContext* context, uint32_t frame,
+                          const DrawUniforms* uniforms) {
+    assert(context->draw_uniform_count[frame] < context->MAX_DRAW_UNIFORMS);
+
+    uint32_t offset = (uint32_t)(context->draw_uniform_stride *
+                                 context->draw_uniform_count[frame]++);
+    memcpy((uint8_t*)context->uniform_buffers_mapped[frame] + offset, uniforms,
+           sizeof(DrawUniforms));
+    return offset;
+}
+
 void CreateDescriptorPool(VulkanContext* context) {
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = context->MAX_FRAMES_IN_FLIGHT;
+    VkDescriptorPoolSize poolSizes[3] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = context->MAX_FRAMES_IN_FLIGHT;
+
+    // GPU particle state
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 1;
+
+    // Sprite atlas or bindless texture array
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount =
+        context->MAX_FRAMES_IN_FLIGHT *
+        (context->bindless_supported ? BINDLESS_TEXTURE_CAPACITY : 1);
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = context->MAX_FRAMES_IN_FLIGHT;
+    poolInfo.poolSizeCount = ArrayCount(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = context->MAX_FRAMES_IN_FLIGHT + 1;
 
     vkCreateDescriptorPool(context->device, &poolInfo, nullptr,
                            &context->descriptor_pool);
@@ -753,80 +1720,213 @@ void CreateDescriptorSets(VulkanContext* context, MemoryArena* arena) {
         VkDescriptorBufferInfo bufferInfo{};
         bufferInfo.buffer = context->uniform_buffers[i];
         bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
+        bufferInfo.range = sizeof(DrawUniforms);
+
+        // The atlas, or every used bindless slot from 0 on
+        VkDescriptorImageInfo imageInfos[SPRITE_MAX] = {};
+        uint32_t imageCount = 1;
+        if (context->bindless_supported) {
+            imageCount = SPRITE_MAX;
+            for (uint32_t j = 0; j < SPRITE_MAX; j++) {
+                imageInfos[j].sampler = context->bindless_textures.sampler;
+                imageInfos[j].imageView = context->bindless_textures.views[j];
+                imageInfos[j].imageLayout =
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            }
+        } else {
+            imageInfos[0].sampler = context->atlas.sampler;
+            imageInfos[0].imageView = context->atlas.view;
+            imageInfos[0].imageLayout =
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
 
-        VkWriteDescriptorSet descriptorWrite{};
-        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrite.dstSet = context->descriptor_sets[i];
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
+        VkWriteDescriptorSet descriptorWrites[2] = {};
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = context->descriptor_sets[i];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType =
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = context->descriptor_sets[i];
+        descriptorWrites[1].dstBinding = context->bindless_supported ? 2 : 1;
+        descriptorWrites[1].dstArrayElement = 0;
+        descriptorWrites[1].descriptorType =
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[1].descriptorCount = imageCount;
+        descriptorWrites[1].pImageInfo = imageInfos;
+
+        vkUpdateDescriptorSets(context->device, ArrayCount(descriptorWrites),
+                               descriptorWrites, 0, nullptr);
+    }
+}
 
-        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrite.descriptorCount = 1;
+// Optional, the renderer works without it when particles.comp.spv is missing
+void CreateParticleSimulation(VulkanContext* context, MemoryArena* arena) {
+#if SDL_PLATFORM_WINDOWS
+    const char* comp_shader_path = ".\\shaders\\particles.comp.spv";
+#else
+    const char* comp_shader_path = "./shaders/particles.comp.spv";
+#endif
 
-        descriptorWrite.pBufferInfo = &bufferInfo;
-        descriptorWrite.pImageInfo = nullptr;
-        descriptorWrite.pTexelBufferView = nullptr;
+    context->gpu_particles_supported = false;
 
-        vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0,
-                               nullptr);
+    VkShaderModule comp_shader_module =
+        CreateShaderModule(context, comp_shader_path, arena);
+    if (comp_shader_module == VK_NULL_HANDLE) {
+        fprintf(stderr, "GPU particles disabled\n");
+        return;
     }
-}
 
-void CreateInstanceBuffer(VulkanContext* context) {
-    std::vector<InstanceData> instances;
-    instances.reserve(10 * 10);
+    VkDeviceSize buffer_size =
+        sizeof(GpuParticle) * context->GPU_PARTICLE_CAPACITY;
+    CreateBuffer(context, buffer_size,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 context->gpu_particle_buffer,
+                 context->gpu_particle_buffer_allocation);
+
+    // Zero life and size, every slot starts out dead
+    VkCommandBuffer cmd = BeginSingleTimeCommands(context);
+    vkCmdFillBuffer(cmd, context->gpu_particle_buffer, 0, VK_WHOLE_SIZE, 0);
+    EndSingleTimeCommands(context, cmd);
+
+    VkDescriptorSetLayoutBinding storage_binding{};
+    storage_binding.binding = 0;
+    storage_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    storage_binding.descriptorCount = 1;
+    storage_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-    for (int i = 0; i < 10; i++) {
-        for (int j = 0; j < 10; j++) {
-            InstanceData instance;
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &storage_binding;
 
-            float x = i * 1.0f;
-            float y = j * 1.0f;
+    VkResult res = vkCreateDescriptorSetLayout(
+        context->device, &layoutInfo, nullptr,
+        &context->particle_descriptor_set_layout);
+    assert(res == VK_SUCCESS);
 
-            instance.transform =
-                multiply(translate(x, y, 0.0f), scale(40.0f, 40.0f, 1.0f));
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = context->descriptor_pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &context->particle_descriptor_set_layout;
 
-            instance.color = {
-                (float)i / 5.0f,
-                (float)j / 5.0f,
-                0.5f,
-            };
+    res = vkAllocateDescriptorSets(context->device, &allocInfo,
+                                   &context->particle_descriptor_set);
+    assert(res == VK_SUCCESS);
 
-            instances.emplace_back(instance);
-        }
-    }
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = context->gpu_particle_buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = context->particle_descriptor_set;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &bufferInfo;
 
-    VkDeviceSize bufferSize = sizeof(instances[0]) * instances.size();
+    vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, nullptr);
 
-    assert(bufferSize <= context->STAGING_BUFFER_SIZE);
-    assert(context->instance_buffer_size + bufferSize <=
-           context->MAX_INSTANCE_BUFFER_SIZE);
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(GpuParticleParams);
 
-    context->instance_buffer_size += bufferSize;
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &context->particle_descriptor_set_layout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push_constant_range;
 
-    memcpy(context->staging_buffer_mapped, instances.data(),
-           (size_t)bufferSize);
+    res = vkCreatePipelineLayout(context->device, &pipelineLayoutInfo, 0,
+                                 &context->particle_compute_layout);
+    assert(res == VK_SUCCESS);
 
-    CopyBuffer(context, context->staging_buffer, context->device_memory_buffer,
-               bufferSize, context->instance_buffer_offset);
-}
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = comp_shader_module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = context->particle_compute_layout;
+
+    res = vkCreateComputePipelines(context->device, context->pipeline_cache, 1,
+                                   &pipelineInfo, nullptr,
+                                   &context->particle_compute_pipeline);
+    assert(res == VK_SUCCESS);
 
-void CreateIndexBuffer(VulkanContext* context) {
-    const std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 0};
+    vkDestroyShaderModule(context->device, comp_shader_module, 0);
 
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    context->gpu_particle_spawn_cursor = 0;
+    context->gpu_particle_spawn_first = 0;
+    context->gpu_particle_spawn_count = 0;
+    context->gpu_particle_live_count = 0;
+    context->gpu_particle_clock = 0.0;
+    context->gpu_particles_this_frame = false;
+    context->gpu_particles_supported = true;
+}
 
-    assert(bufferSize <= context->STAGING_BUFFER_SIZE);
-    assert(context->index_buffer_size + bufferSize <=
-           context->MAX_INDEX_BUFFER_SIZE);
+void RecordParticleSimulation(VulkanContext* context, VkCommandBuffer cmd) {
+    // Previous frames read the buffer as vertex input and wrote it here
+    VkMemoryBarrier2 before_dispatch{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                         VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    };
 
-    context->index_buffer_size += bufferSize;
+    VkDependencyInfo before_dependency{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &before_dispatch,
+    };
 
-    memcpy(context->staging_buffer_mapped, indices.data(), (size_t)bufferSize);
+    context->func_table.vkCmdPipelineBarrier2KHR(cmd, &before_dependency);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      context->particle_compute_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            context->particle_compute_layout, 0, 1,
+                            &context->particle_descriptor_set, 0, nullptr);
+    vkCmdPushConstants(cmd, context->particle_compute_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(GpuParticleParams),
+                       &context->gpu_particle_params);
+
+    const uint32_t local_size = 256;  // matches particles.comp
+    uint32_t simulate_count = context->gpu_particle_params.simulate_count;
+    vkCmdDispatch(cmd, (simulate_count + local_size - 1) / local_size, 1, 1);
+
+    VkMemoryBarrier2 after_dispatch{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT,
+        .dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+    };
+
+    VkDependencyInfo after_dependency{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &after_dispatch,
+    };
 
-    CopyBuffer(context, context->staging_buffer, context->device_memory_buffer,
-               bufferSize, context->index_buffer_offset);
+    context->func_table.vkCmdPipelineBarrier2KHR(cmd, &after_dependency);
 }
 
 void CreateCommandBuffers(VulkanContext* context, MemoryArena* arena) {
@@ -846,53 +1946,251 @@ void CreateCommandBuffers(VulkanContext* context, MemoryArena* arena) {
     }
 }
 
-void TransitionImageLayout(VulkanContext* context, VkCommandBuffer cmd,
-                           VkImage image, VkImageLayout oldLayout,
-                           VkImageLayout newLayout,
-                           VkAccessFlags2 srcAccessMask,
-                           VkAccessFlags2 dstAccessMask,
-                           VkPipelineStageFlags2 srcStageMask,
-                           VkPipelineStageFlags2 dstStageMask) {
-    VkImageMemoryBarrier2KHR image_barrier{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+void CreateTimestampQueries(VulkanContext* context, MemoryArena* arena) {
+    queue_indices q_idxs =
+        get_graphics_and_present_queue_indices(context, arena);
 
-        .srcStageMask = srcStageMask,
-        .srcAccessMask = srcAccessMask,
-        .dstStageMask = dstStageMask,
-        .dstAccessMask = dstAccessMask,
+    temp_arena tmp = begin_temp_arena(arena);
 
-        .oldLayout = oldLayout,
-        .newLayout = newLayout,
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(context->physical_device,
+                                             &queue_family_count, 0);
+    VkQueueFamilyProperties* queue_families =
+        (VkQueueFamilyProperties*)arena_push(
+            arena, sizeof(VkQueueFamilyProperties) * queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        context->physical_device, &queue_family_count, queue_families);
 
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    uint32_t valid_bits = queue_families[*q_idxs.graphics].timestampValidBits;
 
-        .image = image,
+    end_temp_arena(&tmp);
 
-        .subresourceRange =
-            {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    context->gpu_timestamps_supported =
+        valid_bits > 0 && context->func_table.vkCmdWriteTimestamp2KHR;
+    if (!context->gpu_timestamps_supported) {
+        fprintf(stderr, "GPU timestamps are not supported, GPU zones off\n");
+        return;
+    }
 
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
+    context->timestamp_period = context->physical_device_properties2.properties
+                                    .limits.timestampPeriod;
+    context->timestamp_mask =
+        valid_bits >= 64 ? ~0ull : ((1ull << valid_bits) - 1);
+
+    uint32_t frames = context->MAX_FRAMES_IN_FLIGHT;
+    context->timestamp_query_pools =
+        (VkQueryPool*)arena_push(arena, sizeof(VkQueryPool) * frames);
+    context->gpu_profile_zones =
+        (GpuProfileZone**)arena_push(arena, sizeof(GpuProfileZone*) * frames);
+    context->gpu_profile_zone_count =
+        (uint32_t*)arena_push(arena, sizeof(uint32_t) * frames);
+    context->frame_submit_ticks =
+        (uint64_t*)arena_push(arena, sizeof(uint64_t) * frames);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = context->MAX_GPU_PROFILE_ZONES * 2;
+
+        VkResult res = vkCreateQueryPool(context->device, &poolInfo, nullptr,
+                                         &context->timestamp_query_pools[i]);
+        assert(res == VK_SUCCESS);
+
+        context->gpu_profile_zones[i] = (GpuProfileZone*)arena_push(
+            arena, sizeof(GpuProfileZone) * context->MAX_GPU_PROFILE_ZONES);
+        context->gpu_profile_zone_count[i] = 0;
+        context->frame_submit_ticks[i] = 0;
+    }
+}
+
+// Returns the zone index for GpuZoneEnd, or UINT32_MAX when GPU zones are
+// off or the frame ran out of queries
+uint32_t GpuZoneBegin(VulkanContext* context, VkCommandBuffer cmd,
+                      uint32_t frame, const char* name) {
+    if (!GLOBAL_profiler.enabled || !context->gpu_timestamps_supported ||
+        context->gpu_profile_zone_count[frame] >=
+            context->MAX_GPU_PROFILE_ZONES) {
+        return UINT32_MAX;
+    }
+
+    uint32_t zone_index = context->gpu_profile_zone_count[frame]++;
+    GpuProfileZone* zone = &context->gpu_profile_zones[frame][zone_index];
+    zone->name = name;
+    zone->begin_query = zone_index * 2;
+    zone->end_query = zone_index * 2 + 1;
+
+    context->func_table.vkCmdWriteTimestamp2KHR(
+        cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        context->timestamp_query_pools[frame], zone->begin_query);
+
+    return zone_index;
+}
+
+void GpuZoneEnd(VulkanContext* context, VkCommandBuffer cmd, uint32_t frame,
+                uint32_t zone_index) {
+    if (zone_index == UINT32_MAX) {
+        return;
+    }
+
+    GpuProfileZone* zone = &context->gpu_profile_zones[frame][zone_index];
+    context->func_table.vkCmdWriteTimestamp2KHR(
+        cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        context->timestamp_query_pools[frame], zone->end_query);
+}
+
+// Called once the frame's fence signalled, moves last time's zones into the
+// profiler. NOTE: Device ticks are placed on the CPU timeline relative to the
+// submit time of the frame, good enough to line frames up in the trace.
+void CollectGpuZones(VulkanContext* context, uint32_t frame) {
+    if (!context->gpu_timestamps_supported) {
+        return;
+    }
+
+    uint32_t zone_count = context->gpu_profile_zone_count[frame];
+    context->gpu_profile_zone_count[frame] = 0;
+    if (zone_count == 0 || !GLOBAL_profiler.enabled) {
+        return;
+    }
+
+    uint64_t timestamps[32];
+    assert(zone_count * 2 <= ArrayCount(timestamps));
+
+    VkResult res = vkGetQueryPoolResults(
+        context->device, context->timestamp_query_pools[frame], 0,
+        zone_count * 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        return;
+    }
+
+    uint64_t first = timestamps[0] & context->timestamp_mask;
+    double ticks_per_device_tick = context->timestamp_period * 1e-9 *
+                                   (double)GLOBAL_profiler.timer_frequency;
+    uint64_t submit = context->frame_submit_ticks[frame];
+
+    for (uint32_t i = 0; i < zone_count; i++) {
+        GpuProfileZone* zone = &context->gpu_profile_zones[frame][i];
+        uint64_t begin = timestamps[zone->begin_query] & context->timestamp_mask;
+        uint64_t end = timestamps[zone->end_query] & context->timestamp_mask;
+
+        profiler_record(
+            &GLOBAL_profiler, zone->name,
+            submit + (uint64_t)((begin - first) * ticks_per_device_tick),
+            submit + (uint64_t)((end - first) * ticks_per_device_tick),
+            PROFILER_GPU_TRACK);
+    }
+}
+
+// Lets the game see what is resident, it resends layers whose content
+// never made it
+void ReportStaticLayers(VulkanContext* context, PushBuffer* pb) {
+    for (uint32_t i = 0; i < STATIC_LAYER_MAX; i++) {
+        StaticLayerResident* resident = &context->static_layers[i];
+        pb->resident_static_hashes[i] = resident->valid ? resident->hash : 0;
+    }
+}
+
+// Draws a static layer's batches out of its resident buffer, with
+// whatever uniforms are bound
+void RecordStaticLayer(VulkanContext* context, VkCommandBuffer cmd,
+                       const StaticLayerResident* resident) {
+    RenderPipelineId bound_pipeline = RENDER_PIPELINE_MAX;
+    StaticMeshId bound_mesh = STATIC_MESH_MAX;
+    for (uint32_t i = 0; i < resident->batch_count; i++) {
+        const DrawBatch* batch = &resident->batches[i];
+
+        if (batch->pipeline != bound_pipeline) {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              context->pipelines[batch->pipeline]);
+
+            VkDeviceSize zero_offset = 0;
+            switch (batch->pipeline) {
+                case PIPELINE_INSTANCED: {
+                    vkCmdBindVertexBuffers(cmd, 1, 1, &resident->buffer,
+                                           &zero_offset);
+                } break;
+                case PIPELINE_SPRITES: {
+                    vkCmdBindVertexBuffers(cmd, 1, 1, &resident->buffer,
+                                           &resident->sprite_offset);
+                } break;
+                default: {
+                    vkCmdBindVertexBuffers(cmd, 0, 1, &resident->buffer,
+                                           &resident->vertex_offset);
+                    bound_mesh = STATIC_MESH_MAX;
+                } break;
+            }
+
+            bound_pipeline = batch->pipeline;
+        }
+
+        if (batch->pipeline == PIPELINE_TRIANGLES) {
+            vkCmdDraw(cmd, batch->count, 1, batch->first, 0);
+            continue;
+        }
+
+        StaticMesh* mesh = &context->static_meshes[batch->mesh];
+        if (batch->mesh != bound_mesh) {
+            VkDeviceSize zero_offset = 0;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &mesh->vertex_buffer,
+                                   &zero_offset);
+            vkCmdBindIndexBuffer(cmd, mesh->index_buffer, 0,
+                                 VK_INDEX_TYPE_UINT32);
+            bound_mesh = batch->mesh;
+        }
+
+        vkCmdDrawIndexed(cmd, mesh->index_count, batch->count, 0, 0,
+                         batch->first);
+    }
+}
+
+// Copies the rendered image into capture_buffer, tightly packed BGRA8
+void RecordCapture(VulkanContext* context, VkCommandBuffer cmd,
+                   VkImage image) {
+    TransitionImageLayout(context, cmd, image,
+                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                          VK_ACCESS_2_TRANSFER_READ_BIT,
+                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          VK_PIPELINE_STAGE_2_COPY_BIT);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {context->swapchain_extent.width,
+                          context->swapchain_extent.height, 1};
+
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           context->capture_buffer, 1, &region);
+
+    VkMemoryBarrier2KHR host_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+        .dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
     };
 
     VkDependencyInfo dependency_info{
         .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .dependencyFlags = 0,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &image_barrier,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &host_barrier,
     };
-
     context->func_table.vkCmdPipelineBarrier2KHR(cmd, &dependency_info);
 }
 
 void RecordCommandBuffer(VulkanContext* context, uint32_t image_index,
                          MemoryArena* arena, uint32_t current_frame,
                          PushBuffer* pb) {
+    PROFILE_SCOPE("RecordCommandBuffer");
+
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -900,6 +2198,39 @@ void RecordCommandBuffer(VulkanContext* context, uint32_t image_index,
                                         &beginInfo);
     assert(res == VK_SUCCESS);
 
+    if (context->gpu_timestamps_supported) {
+        vkCmdResetQueryPool(context->command_buffers[current_frame],
+                            context->timestamp_query_pools[current_frame], 0,
+                            context->MAX_GPU_PROFILE_ZONES * 2);
+    }
+
+    uint32_t frame_zone =
+        GpuZoneBegin(context, context->command_buffers[current_frame],
+                     current_frame, "gpu_frame");
+
+    uint32_t copy_zone =
+        GpuZoneBegin(context, context->command_buffers[current_frame],
+                     current_frame, "gpu_copies");
+    RecordPendingCopies(context, context->command_buffers[current_frame],
+                        current_frame);
+    GpuZoneEnd(context, context->command_buffers[current_frame], current_frame,
+               copy_zone);
+
+    if (context->gpu_particles_this_frame &&
+        context->gpu_particle_params.simulate_count > 0) {
+        uint32_t particle_zone =
+            GpuZoneBegin(context, context->command_buffers[current_frame],
+                         current_frame, "gpu_particle_simulation");
+        RecordParticleSimulation(context,
+                                 context->command_buffers[current_frame]);
+        GpuZoneEnd(context, context->command_buffers[current_frame],
+                   current_frame, particle_zone);
+    }
+
+    uint32_t draw_zone =
+        GpuZoneBegin(context, context->command_buffers[current_frame],
+                     current_frame, "gpu_draw");
+
     TransitionImageLayout(context, context->command_buffers[current_frame],
                           context->swapchain_images[image_index],
                           VK_IMAGE_LAYOUT_UNDEFINED,
@@ -943,10 +2274,6 @@ void RecordCommandBuffer(VulkanContext* context, uint32_t image_index,
     context->func_table.vkCmdBeginRenderingKHR(
         context->command_buffers[current_frame], &renderingInfo);
 
-    vkCmdBindPipeline(context->command_buffers[current_frame],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      context->graphics_pipeline);
-
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -961,35 +2288,152 @@ void RecordCommandBuffer(VulkanContext* context, uint32_t image_index,
     scissor.extent = context->swapchain_extent;
     vkCmdSetScissor(context->command_buffers[current_frame], 0, 1, &scissor);
 
-    VkBuffer vertexBuffers[] = {context->device_memory_buffer,
-                                context->device_memory_buffer};
-    VkDeviceSize offsets[] = {context->vertex_buffer_offset,
-                              context->instance_buffer_offset};
+    // All graphics pipelines share pipeline_layout, so the push constants
+    // stay valid across pipeline binds
+    vkCmdPushConstants(context->command_buffers[current_frame],
+                       context->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(ViewPushConstants), &context->view_constants);
+
+    // Batches come out of the sort grouped by layer, then pipeline, then
+    // mesh. The pipeline and per-instance buffer are only rebound when the
+    // pipeline changes, a mesh's vertex and index buffer when the mesh does.
+    RenderPipelineId bound_pipeline = RENDER_PIPELINE_MAX;
+    StaticMeshId bound_mesh = STATIC_MESH_MAX;
+    uint32_t bound_uniform_offset = UINT32_MAX;
+    for (uint32_t i = 0; i < context->draw_batch_count; i++) {
+        DrawBatch* batch = &context->draw_batches[i];
+
+        if (batch->pipeline == PIPELINE_GPU_PARTICLES &&
+            !context->gpu_particles_this_frame) {
+            continue;
+        }
+
+        if (batch->pipeline == PIPELINE_STATIC_LAYER) {
+            if (batch->uniform_offset != bound_uniform_offset) {
+                vkCmdBindDescriptorSets(
+                    context->command_buffers[current_frame],
+                    VK_PIPELINE_BIND_POINT_GRAPHICS, context->pipeline_layout,
+                    0, 1, &context->descriptor_sets[current_frame], 1,
+                    &batch->uniform_offset);
+                bound_uniform_offset = batch->uniform_offset;
+            }
+
+            RecordStaticLayer(context, context->command_buffers[current_frame],
+                              &context->static_layers[batch->first]);
+
+            // The layer bound its own buffers
+            bound_pipeline = RENDER_PIPELINE_MAX;
+            bound_mesh = STATIC_MESH_MAX;
+            continue;
+        }
+
+        if (batch->pipeline != bound_pipeline) {
+            vkCmdBindPipeline(context->command_buffers[current_frame],
+                              VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              context->pipelines[batch->pipeline]);
+
+            VkDeviceSize zero_offset = 0;
+            switch (batch->pipeline) {
+                case PIPELINE_INSTANCED: {
+                    vkCmdBindVertexBuffers(
+                        context->command_buffers[current_frame], 1, 1,
+                        &context->instance_bind_buffer,
+                        &context->instance_bind_offset);
+                } break;
+                case PIPELINE_SPRITES: {
+                    vkCmdBindVertexBuffers(
+                        context->command_buffers[current_frame], 1, 1,
+                        &context->instance_bind_buffer,
+                        &context->sprite_bind_offset);
+                } break;
+                case PIPELINE_TRIANGLES: {
+                    vkCmdBindVertexBuffers(
+                        context->command_buffers[current_frame], 0, 1,
+                        &context->dynamic_vertex_bind_buffer,
+                        &context->dynamic_vertex_bind_offset);
+                    bound_mesh = STATIC_MESH_MAX;
+                } break;
+                case PIPELINE_GPU_PARTICLES: {
+                    vkCmdBindVertexBuffers(
+                        context->command_buffers[current_frame], 1, 1,
+                        &context->gpu_particle_buffer, &zero_offset);
+                } break;
+                default:
+                    break;
+            }
+
+            bound_pipeline = batch->pipeline;
+        }
+
+        if (batch->uniform_offset != bound_uniform_offset) {
+            vkCmdBindDescriptorSets(
+                context->command_buffers[current_frame],
+                VK_PIPELINE_BIND_POINT_GRAPHICS, context->pipeline_layout, 0,
+                1, &context->descriptor_sets[current_frame], 1,
+                &batch->uniform_offset);
+            bound_uniform_offset = batch->uniform_offset;
+        }
 
-    vkCmdBindVertexBuffers(context->command_buffers[current_frame], 0, 2,
-                           vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(context->command_buffers[current_frame],
-                         context->device_memory_buffer,
-                         context->index_buffer_offset, VK_INDEX_TYPE_UINT32);
+        if (batch->pipeline == PIPELINE_TRIANGLES) {
+            vkCmdDraw(context->command_buffers[current_frame], batch->count, 1,
+                      batch->first, 0);
+            continue;
+        }
 
-    vkCmdBindDescriptorSets(
-        context->command_buffers[current_frame],
-        VK_PIPELINE_BIND_POINT_GRAPHICS, context->pipeline_layout, 0, 1,
-        &context->descriptor_sets[current_frame], 0, nullptr);
+        StaticMesh* mesh = &context->static_meshes[batch->mesh];
+        if (batch->mesh != bound_mesh) {
+            VkDeviceSize zero_offset = 0;
+            vkCmdBindVertexBuffers(context->command_buffers[current_frame], 0,
+                                   1, &mesh->vertex_buffer, &zero_offset);
+            vkCmdBindIndexBuffer(context->command_buffers[current_frame],
+                                 mesh->index_buffer, 0, VK_INDEX_TYPE_UINT32);
+            bound_mesh = batch->mesh;
+        }
 
-    vkCmdDrawIndexed(context->command_buffers[current_frame], 6,
-                     pb->number_of_entries, 0, 0, 0);
+        if (batch->pipeline == PIPELINE_GPU_PARTICLES) {
+            // Dead particles inside the window have a zero size and
+            // collapse to nothing. The window wraps at the ring's end.
+            uint32_t tail = SDL_min(
+                batch->count, context->GPU_PARTICLE_CAPACITY - batch->first);
+            vkCmdDrawIndexed(context->command_buffers[current_frame],
+                             mesh->index_count, tail, 0, 0, batch->first);
+            if (batch->count > tail) {
+                vkCmdDrawIndexed(context->command_buffers[current_frame],
+                                 mesh->index_count, batch->count - tail, 0, 0,
+                                 0);
+            }
+            continue;
+        }
+
+        vkCmdDrawIndexed(context->command_buffers[current_frame],
+                         mesh->index_count, batch->count, 0, 0, batch->first);
+    }
 
     context->func_table.vkCmdEndRenderingKHR(
         context->command_buffers[current_frame]);
 
-    TransitionImageLayout(context, context->command_buffers[current_frame],
-                          context->swapchain_images[image_index],
-                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                          VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                          VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, 0,
-                          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                          VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT);
+    GpuZoneEnd(context, context->command_buffers[current_frame], current_frame,
+               draw_zone);
+
+    if (context->headless) {
+        // The next frame on this image starts from UNDEFINED again
+        if (context->capture_requested) {
+            RecordCapture(context, context->command_buffers[current_frame],
+                          context->swapchain_images[image_index]);
+            context->capture_requested = false;
+        }
+    } else {
+        TransitionImageLayout(context, context->command_buffers[current_frame],
+                              context->swapchain_images[image_index],
+                              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                              VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                              VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, 0,
+                              VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                              VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT);
+    }
+
+    GpuZoneEnd(context, context->command_buffers[current_frame], current_frame,
+               frame_zone);
 
     res = vkEndCommandBuffer(context->command_buffers[current_frame]);
     assert(res == VK_SUCCESS);
@@ -1020,7 +2464,109 @@ void CreateSyncObjects(VulkanContext* context, MemoryArena* arena) {
     }
 }
 
+// Headless stand-in for CreateSwapchain. The images can be copied out, so
+// any frame can be read back with RendererRequestCapture.
+void CreateOffscreenTargets(VulkanContext* context, MemoryArena* arena) {
+    uint32_t image_count = context->MAX_FRAMES_IN_FLIGHT;
+
+    // Supported as a colour attachment and copy source everywhere, including
+    // lavapipe, and already in the byte order BMP wants
+    context->swapchain_format = VK_FORMAT_B8G8R8A8_UNORM;
+    context->swapchain_extent = {
+        (uint32_t)(context->WindowDrawableAreaWidth *
+                   context->WindowPixelDensity),
+        (uint32_t)(context->WindowDrawableAreaHeight *
+                   context->WindowPixelDensity),
+    };
+    context->swapchain_image_count = image_count;
+    context->swapchain_images =
+        (VkImage*)arena_push(arena, image_count * sizeof(VkImage));
+    context->swapchain_image_views =
+        (VkImageView*)arena_push(arena, image_count * sizeof(VkImageView));
+    context->offscreen_image_allocations = (GpuAllocation*)arena_push(
+        arena, image_count * sizeof(GpuAllocation));
+
+    for (uint32_t i = 0; i < image_count; i++) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = context->swapchain_format;
+        imageInfo.extent = {context->swapchain_extent.width,
+                            context->swapchain_extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                          VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkResult res = vkCreateImage(context->device, &imageInfo, nullptr,
+                                     &context->swapchain_images[i]);
+        assert(res == VK_SUCCESS);
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(context->device,
+                                     context->swapchain_images[i],
+                                     &memRequirements);
+
+        GpuAllocation* allocation = &context->offscreen_image_allocations[i];
+        bool allocated = gpu_alloc(context->gpu_allocator, memRequirements,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                   GPU_RESOURCE_OPTIMAL, allocation);
+        assert(allocated);
+        vkBindImageMemory(context->device, context->swapchain_images[i],
+                          allocation->memory, allocation->offset);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = context->swapchain_images[i];
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = context->swapchain_format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        res = vkCreateImageView(context->device, &viewInfo, nullptr,
+                                &context->swapchain_image_views[i]);
+        assert(res == VK_SUCCESS);
+    }
+
+    VkDeviceSize capture_size = (VkDeviceSize)context->swapchain_extent.width *
+                                context->swapchain_extent.height * 4;
+    CreateBuffer(context, capture_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 context->capture_buffer, context->capture_buffer_allocation);
+    context->capture_buffer_mapped = context->capture_buffer_allocation.mapped;
+
+    fprintf(stderr, "Offscreen extent: %d, %d\n",
+            context->swapchain_extent.width, context->swapchain_extent.height);
+}
+
+// Headless only, the next RendererDrawFrame copies its image out
+void RendererRequestCapture(VulkanContext* context) {
+    assert(context->headless);
+    context->capture_requested = true;
+}
+
+// Waits for the GPU and returns the captured frame, BGRA8 rows top to bottom
+// with swapchain_extent.width pixels each
+const uint32_t* RendererFinishCapture(VulkanContext* context) {
+    assert(context->headless);
+    vkDeviceWaitIdle(context->device);
+    return (const uint32_t*)context->capture_buffer_mapped;
+}
+
 void RecreateSwapchainResources(VulkanContext* context, MemoryArena* arena) {
+    // Offscreen targets have a fixed size
+    if (context->headless) {
+        return;
+    }
+
     fprintf(stderr, "Recreating swapchain\n");
 
     vkDeviceWaitIdle(context->device);
@@ -1057,14 +2603,18 @@ void RecreateSwapchainResources(VulkanContext* context, MemoryArena* arena) {
     }
 }
 
+// window is unused and may be null when context->headless is set
 void RendererInit(VulkanContext* context, SDL_Window* window,
                   MemoryArena* renderer_arena) {
+    assert(window || context->headless);
+
+    uint64_t init_start = SDL_GetPerformanceCounter();
+
     const char* validation_layers[] = {
         "VK_LAYER_KHRONOS_validation",
     };
 
     std::vector<const char*> device_extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
         VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
         VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME,
@@ -1073,6 +2623,10 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
 #endif
     };
 
+    if (!context->headless) {
+        device_extensions.emplace_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+
     std::vector<const char*> instance_extensions;
 
     uint32_t instance_api_version = 0;
@@ -1115,19 +2669,21 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
     instance_info.pNext = 0;
 #endif
 
-    uint32_t glfwExtensionCount = 0;
-    char const* const* glfwExtensions;
-    glfwExtensions = SDL_Vulkan_GetInstanceExtensions(&glfwExtensionCount);
+    if (!context->headless) {
+        uint32_t glfwExtensionCount = 0;
+        char const* const* glfwExtensions;
+        glfwExtensions = SDL_Vulkan_GetInstanceExtensions(&glfwExtensionCount);
 
-    instance_extensions.reserve(glfwExtensionCount + 10);
-    for (uint32_t i = 0; i < glfwExtensionCount; i++) {
-        instance_extensions.emplace_back(glfwExtensions[i]);
-    }
+        instance_extensions.reserve(glfwExtensionCount + 10);
+        for (uint32_t i = 0; i < glfwExtensionCount; i++) {
+            instance_extensions.emplace_back(glfwExtensions[i]);
+        }
 
-    instance_extensions.emplace_back(
-        VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
-    instance_extensions.emplace_back(
-        VK_EXT_SWAPCHAIN_COLOR_SPACE_EXTENSION_NAME);
+        instance_extensions.emplace_back(
+            VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+        instance_extensions.emplace_back(
+            VK_EXT_SWAPCHAIN_COLOR_SPACE_EXTENSION_NAME);
+    }
     instance_extensions.emplace_back(
         VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
@@ -1202,7 +2758,10 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
 
     end_temp_arena(&tmparen);
 
-    SDL_Vulkan_CreateSurface(window, context->instance, 0, &context->surface);
+    if (!context->headless) {
+        SDL_Vulkan_CreateSurface(window, context->instance, 0,
+                                 &context->surface);
+    }
 
     queue_indices q_indices =
         get_graphics_and_present_queue_indices(context, renderer_arena);
@@ -1243,9 +2802,14 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
 
     };
 
+    VkPhysicalDeviceVulkan12Features vk12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = &vk13_features,
+    };
+
     VkPhysicalDeviceFeatures2 physical_features2 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
-        .pNext = &vk13_features,
+        .pNext = &vk12_features,
     };
 
     vkGetPhysicalDeviceFeatures2(context->physical_device, &physical_features2);
@@ -1264,6 +2828,24 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
         fprintf(stderr, "Sample rate shading is not supported by the GPU!\n");
     }
 
+    // Set VKH_NO_BINDLESS to force the atlas path for comparison
+    VkPhysicalDeviceLimits* limits =
+        &context->physical_device_properties2.properties.limits;
+    context->bindless_supported =
+        vk12_features.descriptorBindingPartiallyBound &&
+        vk12_features.shaderSampledImageArrayNonUniformIndexing &&
+        limits->maxPerStageDescriptorSamplers >= BINDLESS_TEXTURE_CAPACITY &&
+        limits->maxPerStageDescriptorSampledImages >=
+            BINDLESS_TEXTURE_CAPACITY &&
+        limits->maxDescriptorSetSamplers >= BINDLESS_TEXTURE_CAPACITY &&
+        limits->maxDescriptorSetSampledImages >= BINDLESS_TEXTURE_CAPACITY &&
+        !SDL_getenv("VKH_NO_BINDLESS");
+    if (!context->bindless_supported) {
+        fprintf(stderr,
+                "Descriptor indexing is not supported, sprites use the "
+                "atlas\n");
+    }
+
     VkPhysicalDeviceVulkan13Features enable_vk13_features = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
         .pNext = 0,
@@ -1271,9 +2853,17 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
         .dynamicRendering = VK_TRUE,
     };
 
+    VkPhysicalDeviceVulkan12Features enable_vk12_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = &enable_vk13_features,
+        .shaderSampledImageArrayNonUniformIndexing =
+            context->bindless_supported,
+        .descriptorBindingPartiallyBound = context->bindless_supported,
+    };
+
     VkPhysicalDeviceFeatures2 enable_physical_features2 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
-        .pNext = &enable_vk13_features,
+        .pNext = &enable_vk12_features,
         .features =
             {
                 .sampleRateShading = VK_TRUE,
@@ -1311,6 +2901,9 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
     context->func_table.vkCmdPipelineBarrier2KHR =
         reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetInstanceProcAddr(
             context->instance, "vkCmdPipelineBarrier2KHR"));
+    context->func_table.vkCmdWriteTimestamp2KHR =
+        reinterpret_cast<PFN_vkCmdWriteTimestamp2KHR>(vkGetInstanceProcAddr(
+            context->instance, "vkCmdWriteTimestamp2KHR"));
 
     vkGetDeviceQueue(context->device, *q_indices.graphics, 0,
                      &context->graphics_queue);
@@ -1322,7 +2915,16 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
 
     end_temp_arena(&tmp);
 
-    CreateSwapchain(context, renderer_arena);
+    context->gpu_allocator =
+        (GpuAllocator*)arena_push(renderer_arena, sizeof(GpuAllocator));
+    gpu_allocator_init(context->gpu_allocator, context->physical_device,
+                       context->device, renderer_arena);
+
+    if (context->headless) {
+        CreateOffscreenTargets(context, renderer_arena);
+    } else {
+        CreateSwapchain(context, renderer_arena);
+    }
     CreateSyncObjects(context, renderer_arena);
 
     CreateDescriptorSetLayout(context, renderer_arena);
@@ -1330,114 +2932,981 @@ void RendererInit(VulkanContext* context, SDL_Window* window,
     CreateCommandPool(context, renderer_arena);
     CreateDescriptorPool(context);
 
-    CreateGraphicsPipeline(context, renderer_arena);
     CreateCommandBuffers(context, renderer_arena);
+    CreateTimestampQueries(context, renderer_arena);
 
-    CreateDeviceMemoryBuffer(context);
+    CreatePipelineCache(context);
+    uint64_t pipelines_start = SDL_GetPerformanceCounter();
+    CreateGraphicsPipeline(context, renderer_arena);
+    CreateParticleSimulation(context, renderer_arena);
+    uint64_t pipelines_end = SDL_GetPerformanceCounter();
+
+    // Every pipeline exists by now, nothing is added to the cache later
+    SavePipelineCache(context, renderer_arena);
+
+    context->draw_batches = (DrawBatch*)arena_push(
+        renderer_arena, sizeof(DrawBatch) * context->MAX_DRAW_BATCHES);
+    context->draw_batch_count = 0;
+    CreateRetiredBufferLists(context, renderer_arena);
+
+    CreateDirectUploadBuffer(context);
+    if (!context->direct_upload_supported) {
+        CreateFrameBuffers(context, renderer_arena);
+    }
     CreateDeviceStagingBuffer(context, renderer_arena);
+    UploadStaticGeometry(context);
+    CreateSpriteTextures(context);
 
-    // TODO: Allocate from host visible memory
     CreateUniformBuffers(context, renderer_arena);
 
     CreateDescriptorSets(context, renderer_arena);
-}
 
-void UpdateUniformBuffer(VulkanContext* context, uint32_t frame_index) {
-    UniformBufferObject ubo = {};
-
-    ubo.model = identity();
-    ubo.view = identity();
+    GpuAllocatorStats stats = gpu_allocator_stats(context->gpu_allocator);
+    fprintf(stderr,
+            "GPU memory: %u blocks (%u dedicated), %u allocations, %llu MB "
+            "reserved, %llu MB used\n",
+            stats.block_count, stats.dedicated_count, stats.allocation_count,
+            (unsigned long long)(stats.reserved_bytes / (1024 * 1024)),
+            (unsigned long long)(stats.used_bytes / (1024 * 1024)));
+
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    fprintf(stderr, "RendererInit: %.2f ms, pipelines %.2f ms\n",
+            (SDL_GetPerformanceCounter() - init_start) * ms_per_tick,
+            (pipelines_end - pipelines_start) * ms_per_tick);
+}
 
-    float aspect = context->swapchain_extent.width /
-                   (float)context->swapchain_extent.height;
+// Must only be called once the frame's in_flight_fence has been waited on.
+void BeginFrameUniforms(VulkanContext* context, uint32_t frame_index,
+                        const RenderCamera* camera) {
+    context->draw_uniform_count[frame_index] = 0;
 
-    ubo.proj = createOrthographicProjection(
+    // Row vectors, so the translation applies first
+    mat4 view = multiply(translate(-camera->x, -camera->y, 0.0f),
+                         scale(camera->zoom, camera->zoom, 1.0f));
+    mat4 proj = createOrthographicProjection(
         0.0f, static_cast<float>(context->swapchain_extent.width),
         static_cast<float>(context->swapchain_extent.height), 0.0f, -1.0f,
         1.0f);
 
-    memcpy(context->uniform_buffers_mapped[frame_index], &ubo, sizeof(ubo));
+    // NOTE: GLSL reads our rows as columns, proj * view in the shader is
+    // multiply(view, proj) here
+    context->view_constants.view_proj = multiply(view, proj);
+}
+
+inline uint32_t PackColorRGBA8(float r, float g, float b, float a) {
+    uint32_t R = (uint32_t)(SDL_clamp(r, 0.0f, 1.0f) * 255.0f + 0.5f);
+    uint32_t G = (uint32_t)(SDL_clamp(g, 0.0f, 1.0f) * 255.0f + 0.5f);
+    uint32_t B = (uint32_t)(SDL_clamp(b, 0.0f, 1.0f) * 255.0f + 0.5f);
+    uint32_t A = (uint32_t)(SDL_clamp(a, 0.0f, 1.0f) * 255.0f + 0.5f);
+
+    return (A << 24) | (B << 16) | (G << 8) | R;
+}
+
+struct SortEntry {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Stable LSD radix sort on bytes [first_byte, first_byte + byte_count) of the
+// keys. Passes where every key has the same digit are skipped, so a frame
+// with one layer and one pipeline costs a single histogram pass. Returns
+// whichever of the two arrays ends up holding the result.
+SortEntry* RadixSortKeys(SortEntry* entries, SortEntry* scratch,
+                         uint32_t count, uint32_t first_byte,
+                         uint32_t byte_count) {
+    assert(first_byte + byte_count <= 8);
+
+    uint32_t histograms[8][256] = {};
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t key = entries[i].key;
+        for (uint32_t b = 0; b < byte_count; b++) {
+            histograms[b][(key >> (8 * (first_byte + b))) & 0xFF]++;
+        }
+    }
+
+    SortEntry* src = entries;
+    SortEntry* dst = scratch;
+    for (uint32_t b = 0; b < byte_count; b++) {
+        uint32_t shift = 8 * (first_byte + b);
+        uint32_t* histogram = histograms[b];
+
+        if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            uint32_t digit_count = histogram[digit];
+            histogram[digit] = offset;
+            offset += digit_count;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+
+        SortEntry* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    return src;
+}
+
+struct ConvertEntriesJob {
+    PushBufferEntry* entries;
+    SortEntry* sorted;
+    uint32_t count;
+    RenderPipelineId pipeline;
+    const SpriteTable* sprites;
+    void* output;  // InstanceData2D, ColorVertex2D or SpriteInstance2D
+};
+
+void ConvertPushBufferEntries(void* data) {
+    PROFILE_SCOPE("ConvertPushBufferEntries");
+
+    ConvertEntriesJob* job = (ConvertEntriesJob*)data;
+
+    switch (job->pipeline) {
+        case PIPELINE_INSTANCED: {
+            InstanceData2D* instances = (InstanceData2D*)job->output;
+            for (uint32_t i = 0; i < job->count; i++) {
+                PushBufferEntry* pbe = &job->entries[job->sorted[i].index];
+                InstanceData2D* instance = &instances[i];
+
+                instance->position = {pbe->data.quad.x, pbe->data.quad.y};
+                instance->size = {pbe->data.quad.width, pbe->data.quad.height};
+                instance->color = PackColorRGBA8(pbe->color[0], pbe->color[1],
+                                                 pbe->color[2], 1.0f);
+            }
+        } break;
+        case PIPELINE_SPRITES: {
+            SpriteInstance2D* instances = (SpriteInstance2D*)job->output;
+            for (uint32_t i = 0; i < job->count; i++) {
+                PushBufferEntry* pbe = &job->entries[job->sorted[i].index];
+                SpriteInstance2D* instance = &instances[i];
+
+                uint32_t id = pbe->data.sprite.id;
+                assert(id < SPRITE_MAX);
+                instance->position = {pbe->data.sprite.x, pbe->data.sprite.y};
+                instance->size = {pbe->data.sprite.width,
+                                  pbe->data.sprite.height};
+                instance->color = PackColorRGBA8(pbe->color[0], pbe->color[1],
+                                                 pbe->color[2], 1.0f);
+                memcpy(instance->uv_rect, job->sprites->uv_rects[id],
+                       sizeof(instance->uv_rect));
+                instance->texture = job->sprites->textures[id];
+            }
+        } break;
+        case PIPELINE_TRIANGLES: {
+            ColorVertex2D* vertices = (ColorVertex2D*)job->output;
+            for (uint32_t i = 0; i < job->count; i++) {
+                PushBufferEntry* pbe = &job->entries[job->sorted[i].index];
+                ColorVertex2D* v = &vertices[i * 3];
+
+                uint32_t color = PackColorRGBA8(pbe->color[0], pbe->color[1],
+                                                pbe->color[2], 1.0f);
+                v[0] = {{pbe->data.triangle.x1, pbe->data.triangle.y1}, color};
+                v[1] = {{pbe->data.triangle.x2, pbe->data.triangle.y2}, color};
+                v[2] = {{pbe->data.triangle.x3, pbe->data.triangle.y3}, color};
+            }
+        } break;
+        default:
+            assert(!"Entry type is not converted on the CPU");
+            break;
+    }
+}
+
+// Ages out spawns whose particles have all died, records this frame's
+// spawn and sets the window of slots that can hold live particles
+void PrepareParticleSimulation(VulkanContext* context, PushBufferEntry* pbe) {
+    context->gpu_particles_this_frame =
+        pbe != 0 && context->gpu_particles_supported;
+    if (!context->gpu_particles_this_frame) {
+        return;
+    }
+
+    uint32_t capacity = context->GPU_PARTICLE_CAPACITY;
+    uint32_t spawn_count = SDL_min(pbe->data.gpu_particles.spawn_count, capacity);
+    float delta_time = pbe->data.gpu_particles.delta_time;
+    float lifetime = pbe->data.gpu_particles.lifetime;
+
+    // Only the oldest spawn is retired so the live slots stay contiguous.
+    // The margin covers the shader rounding life differently than the
+    // clock does.
+    const uint32_t history = GPU_PARTICLE_SPAWN_HISTORY;
+    GpuParticleSpawn* spawns = context->gpu_particle_spawns;
+    while (context->gpu_particle_spawn_count > 0) {
+        GpuParticleSpawn* oldest = &spawns[context->gpu_particle_spawn_first];
+        if (context->gpu_particle_clock - oldest->clock <
+            oldest->max_life * 1.001) {
+            break;
+        }
+        context->gpu_particle_live_count -= oldest->count;
+        context->gpu_particle_spawn_first =
+            (context->gpu_particle_spawn_first + 1) % history;
+        context->gpu_particle_spawn_count--;
+    }
+
+    context->gpu_particle_clock += delta_time;
+
+    if (spawn_count > 0) {
+        // particles.comp gives each particle up to 1.5x lifetime
+        float max_life = lifetime * 1.5f;
+        uint32_t first = context->gpu_particle_spawn_first;
+        uint32_t count = context->gpu_particle_spawn_count;
+        if (count == history) {
+            // Out of history, fold into the newest spawn. It lives at
+            // least as long as both, so the window only grows.
+            // Past capacity its older slots are overwritten anyway.
+            GpuParticleSpawn* newest = &spawns[(first + history - 1) % history];
+            uint32_t folded = SDL_min(newest->count + spawn_count, capacity);
+            context->gpu_particle_live_count += folded - newest->count;
+            newest->count = folded;
+            newest->max_life = SDL_max(newest->max_life, max_life);
+            newest->clock = context->gpu_particle_clock;
+        } else {
+            GpuParticleSpawn* spawn = &spawns[(first + count) % history];
+            spawn->count = spawn_count;
+            spawn->max_life = max_life;
+            spawn->clock = context->gpu_particle_clock;
+            context->gpu_particle_spawn_count++;
+            context->gpu_particle_live_count += spawn_count;
+        }
+    }
+
+    GpuParticleParams* params = &context->gpu_particle_params;
+    params->emitter_position = {pbe->data.gpu_particles.x,
+                                pbe->data.gpu_particles.y};
+    params->delta_time = delta_time;
+    params->lifetime = lifetime;
+    params->speed = pbe->data.gpu_particles.speed;
+    params->spawn_start = context->gpu_particle_spawn_cursor;
+    params->spawn_count = spawn_count;
+    params->capacity = capacity;
+    params->seed++;
+
+    // New particles overwrite the oldest slots
+    context->gpu_particle_spawn_cursor =
+        (context->gpu_particle_spawn_cursor + spawn_count) % capacity;
+
+    // The window ends at the cursor, past the newest spawn
+    uint32_t live_count = SDL_min(context->gpu_particle_live_count, capacity);
+    params->simulate_start =
+        (context->gpu_particle_spawn_cursor + capacity - live_count) % capacity;
+    params->simulate_count = live_count;
+}
+
+// Rebuilds the resident copy of a static layer when the reference entry
+// brings content that hashes differently from it. The conversion runs on
+// this thread, it only happens when the layer changed. Returns whether
+// there is a resident copy matching the reference to draw.
+bool UpdateStaticLayer(VulkanContext* context, PushBuffer* pb,
+                       const PushBufferEntry* reference, uint32_t frame) {
+    PROFILE_SCOPE("UpdateStaticLayer");
+
+    uint32_t id = reference->data.static_layer.id;
+    uint64_t hash = reference->data.static_layer.hash;
+    assert(id < STATIC_LAYER_MAX);
+    StaticLayerResident* resident = &context->static_layers[id];
+
+    if (resident->valid && resident->hash == hash) {
+        return true;
+    }
+    if (!reference->data.static_layer.has_content) {
+        // Content the renderer never got, nothing to draw
+        return false;
+    }
+
+    if (resident->buffer != VK_NULL_HANDLE) {
+        RetireBuffer(context, frame, resident->buffer, resident->allocation);
+        resident->buffer = VK_NULL_HANDLE;
+    }
+    resident->valid = true;
+    resident->hash = hash;
+    resident->batch_count = 0;
+
+    uint32_t count = reference->data.static_layer.entry_count;
+    if (count == 0) {
+        return true;
+    }
+
+    ScratchScope scratch;
+    PushBufferEntry* entries = (PushBufferEntry*)pb->static_arena.base +
+                               reference->data.static_layer.first_entry;
+
+    SortEntry* keys =
+        (SortEntry*)arena_push(scratch.arena, sizeof(SortEntry) * count);
+    SortEntry* sort_scratch =
+        (SortEntry*)arena_push(scratch.arena, sizeof(SortEntry) * count);
+    for (uint32_t i = 0; i < count; i++) {
+        keys[i].key = entries[i].sort_key;
+        keys[i].index = i;
+    }
+    SortEntry* sorted = RadixSortKeys(keys, sort_scratch, count,
+                                      SORT_KEY_DEPTH_BITS / 8, 3);
+
+    // Same batching as a frame's, without layers or per-batch uniforms
+    uint32_t instance_count = 0;
+    uint32_t sprite_count = 0;
+    uint32_t triangle_vertex_count = 0;
+    DrawBatch* batch = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        RenderPipelineId pipeline = SortKeyPipeline(sorted[i].key);
+        StaticMeshId mesh = SortKeyMesh(sorted[i].key);
+        assert(pipeline == PIPELINE_INSTANCED ||
+               pipeline == PIPELINE_SPRITES ||
+               pipeline == PIPELINE_TRIANGLES);
+
+        if (!batch || batch->pipeline != pipeline || batch->mesh != mesh) {
+            assert(resident->batch_count < STATIC_LAYER_MAX_BATCHES);
+            batch = &resident->batches[resident->batch_count++];
+            batch->pipeline = pipeline;
+            batch->mesh = mesh;
+            batch->first_entry = i;
+            batch->entry_count = 0;
+            batch->count = 0;
+            batch->uniform_offset = 0;
+            batch->first = pipeline == PIPELINE_INSTANCED ? instance_count
+                           : pipeline == PIPELINE_SPRITES
+                               ? sprite_count
+                               : triangle_vertex_count;
+        }
+
+        batch->entry_count++;
+        if (pipeline == PIPELINE_INSTANCED) {
+            batch->count++;
+            instance_count++;
+        } else if (pipeline == PIPELINE_SPRITES) {
+            batch->count++;
+            sprite_count++;
+        } else {
+            batch->count += 3;
+            triangle_vertex_count += 3;
+        }
+    }
+
+    resident->sprite_offset =
+        (sizeof(InstanceData2D) * instance_count + 15) & ~15ull;
+    resident->vertex_offset =
+        (resident->sprite_offset + sizeof(SpriteInstance2D) * sprite_count +
+         15) &
+        ~15ull;
+    VkDeviceSize size = resident->vertex_offset +
+                        sizeof(ColorVertex2D) * triangle_vertex_count;
+
+    CreateBuffer(context, size,
+                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, resident->buffer,
+                 resident->allocation);
+
+    VkDeviceSize staging_offset;
+    uint8_t* staged = StagingPush(context, frame, size, &staging_offset);
+    for (uint32_t b = 0; b < resident->batch_count; b++) {
+        DrawBatch* draw = &resident->batches[b];
+
+        ConvertEntriesJob job = {};
+        job.entries = entries;
+        job.sorted = sorted + draw->first_entry;
+        job.count = draw->entry_count;
+        job.pipeline = draw->pipeline;
+        job.sprites = &context->sprites;
+        switch (draw->pipeline) {
+            case PIPELINE_INSTANCED:
+                job.output = (InstanceData2D*)staged + draw->first;
+                break;
+            case PIPELINE_SPRITES:
+                job.output = (SpriteInstance2D*)(staged +
+                                                 resident->sprite_offset) +
+                             draw->first;
+                break;
+            default:
+                job.output =
+                    (ColorVertex2D*)(staged + resident->vertex_offset) +
+                    draw->first;
+                break;
+        }
+        ConvertPushBufferEntries(&job);
+    }
+
+    QueueStagingCopy(context, frame, staging_offset, size, resident->buffer,
+                     0);
+    return true;
+}
+
+struct CullRect {
+    float min_x, min_y;
+    float max_x, max_y;
+};
+
+// Bounds of one entry for culling. GPU particles and static layers live on
+// the GPU and are never culled, empty entries never pass.
+static CullRect PushBufferEntryBounds(const PushBufferEntry* pbe) {
+    switch (pbe->type) {
+        case QUAD:
+            return {pbe->data.quad.x, pbe->data.quad.y,
+                    pbe->data.quad.x + pbe->data.quad.width,
+                    pbe->data.quad.y + pbe->data.quad.height};
+        case SPRITE:
+            return {pbe->data.sprite.x, pbe->data.sprite.y,
+                    pbe->data.sprite.x + pbe->data.sprite.width,
+                    pbe->data.sprite.y + pbe->data.sprite.height};
+        case TRIANGLE: {
+            float x1 = pbe->data.triangle.x1, y1 = pbe->data.triangle.y1;
+            float x2 = pbe->data.triangle.x2, y2 = pbe->data.triangle.y2;
+            float x3 = pbe->data.triangle.x3, y3 = pbe->data.triangle.y3;
+            return {SDL_min(x1, SDL_min(x2, x3)), SDL_min(y1, SDL_min(y2, y3)),
+                    SDL_max(x1, SDL_max(x2, x3)), SDL_max(y1, SDL_max(y2, y3))};
+        }
+        case GPU_PARTICLES:
+        case STATIC_LAYER:
+            return {-INFINITY, -INFINITY, INFINITY, INFINITY};
+        default:
+            return {INFINITY, INFINITY, -INFINITY, -INFINITY};
+    }
+}
+
+// Writes a key for every entry that overlaps the visible rectangle of its
+// layer's space and returns how many. Bounds are gathered four entries at
+// a time and tested against the viewport in one go, so culled entries cost
+// no sort, conversion, upload or vertex work.
+static uint32_t CullPushBufferEntries(const PushBuffer* pb,
+                                      const PushBufferEntry* entries,
+                                      uint32_t count, const CullRect* world,
+                                      const CullRect* screen,
+                                      SortEntry* keys) {
+    uint32_t visible = 0;
+
+    for (uint32_t first = 0; first < count; first += 4) {
+        alignas(16) float min_x[4], min_y[4], max_x[4], max_y[4];
+        alignas(16) uint32_t screen_mask[4];
+        uint32_t lanes = SDL_min(4u, count - first);
+
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            CullRect bounds = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+            bool screen_space = false;
+            if (lane < lanes) {
+                const PushBufferEntry* pbe = &entries[first + lane];
+                bounds = PushBufferEntryBounds(pbe);
+                screen_space =
+                    IsScreenSpaceLayer(pb, SortKeyLayer(pbe->sort_key));
+            }
+            min_x[lane] = bounds.min_x;
+            min_y[lane] = bounds.min_y;
+            max_x[lane] = bounds.max_x;
+            max_y[lane] = bounds.max_y;
+            screen_mask[lane] = screen_space ? 0xFFFFFFFFu : 0;
+        }
+
+        uint32_t visible_mask = 0;
+#if VKH_MATH_SSE
+        __m128 mask = _mm_load_ps((const float*)screen_mask);
+        __m128 view_min_x =
+            _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(screen->min_x)),
+                      _mm_andnot_ps(mask, _mm_set1_ps(world->min_x)));
+        __m128 view_min_y =
+            _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(screen->min_y)),
+                      _mm_andnot_ps(mask, _mm_set1_ps(world->min_y)));
+        __m128 view_max_x =
+            _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(screen->max_x)),
+                      _mm_andnot_ps(mask, _mm_set1_ps(world->max_x)));
+        __m128 view_max_y =
+            _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(screen->max_y)),
+                      _mm_andnot_ps(mask, _mm_set1_ps(world->max_y)));
+
+        __m128 overlap_x =
+            _mm_and_ps(_mm_cmplt_ps(_mm_load_ps(min_x), view_max_x),
+                       _mm_cmpgt_ps(_mm_load_ps(max_x), view_min_x));
+        __m128 overlap_y =
+            _mm_and_ps(_mm_cmplt_ps(_mm_load_ps(min_y), view_max_y),
+                       _mm_cmpgt_ps(_mm_load_ps(max_y), view_min_y));
+        visible_mask =
+            (uint32_t)_mm_movemask_ps(_mm_and_ps(overlap_x, overlap_y));
+#elif VKH_MATH_NEON
+        uint32x4_t mask = vld1q_u32(screen_mask);
+        float32x4_t view_min_x = vbslq_f32(mask, vdupq_n_f32(screen->min_x),
+                                           vdupq_n_f32(world->min_x));
+        float32x4_t view_min_y = vbslq_f32(mask, vdupq_n_f32(screen->min_y),
+                                           vdupq_n_f32(world->min_y));
+        float32x4_t view_max_x = vbslq_f32(mask, vdupq_n_f32(screen->max_x),
+                                           vdupq_n_f32(world->max_x));
+        float32x4_t view_max_y = vbslq_f32(mask, vdupq_n_f32(screen->max_y),
+                                           vdupq_n_f32(world->max_y));
+
+        uint32x4_t overlap =
+            vandq_u32(vcltq_f32(vld1q_f32(min_x), view_max_x),
+                      vcgtq_f32(vld1q_f32(max_x), view_min_x));
+        overlap = vandq_u32(overlap, vcltq_f32(vld1q_f32(min_y), view_max_y));
+        overlap = vandq_u32(overlap, vcgtq_f32(vld1q_f32(max_y), view_min_y));
+
+        uint32_t overlap_lanes[4];
+        vst1q_u32(overlap_lanes, overlap);
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            visible_mask |= (overlap_lanes[lane] & 1) << lane;
+        }
+#else
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            const CullRect* view = screen_mask[lane] ? screen : world;
+            if (min_x[lane] < view->max_x && max_x[lane] > view->min_x &&
+                min_y[lane] < view->max_y && max_y[lane] > view->min_y) {
+                visible_mask |= 1u << lane;
+            }
+        }
+#endif
+
+        // Padding lanes have empty bounds and never set their bit
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            if (visible_mask & (1u << lane)) {
+                keys[visible].key = entries[first + lane].sort_key;
+                keys[visible].index = first + lane;
+                visible++;
+            }
+        }
+    }
+
+    return visible;
+}
+
+// Bytes of a frame's instances and triangle vertices. Sprite instances
+// follow the plain ones, 16 byte aligned.
+struct DynamicFrameSizes {
+    VkDeviceSize sprites_offset;
+    VkDeviceSize all_instances;
+    VkDeviceSize triangle_vertices;
+};
+
+DynamicFrameSizes GetDynamicFrameSizes(uint32_t instance_count,
+                                       uint32_t sprite_count,
+                                       uint32_t triangle_vertex_count) {
+    DynamicFrameSizes sizes;
+    sizes.sprites_offset =
+        (sizeof(InstanceData2D) * instance_count + 15) & ~15ull;
+    sizes.all_instances =
+        sizes.sprites_offset + sizeof(SpriteInstance2D) * sprite_count;
+    sizes.triangle_vertices = sizeof(ColorVertex2D) * triangle_vertex_count;
+    return sizes;
+}
+
+enum DynamicFrameOverflow {
+    OVERFLOW_INSTANCES = 1 << 0,
+    OVERFLOW_VERTICES = 1 << 1,
+};
+
+// Which of the frame's instances and triangle vertices don't fit in their
+// buffers. On the staging path both are pushed after whatever the frame
+// staged already, so overrunning the slice is on both of them.
+uint32_t GetDynamicFrameOverflow(VulkanContext* context, uint32_t frame,
+                                 bool direct, DynamicFrameSizes sizes) {
+    uint32_t overflow = 0;
+    if (sizes.all_instances > context->INSTANCE_FRAME_SIZE) {
+        overflow |= OVERFLOW_INSTANCES;
+    }
+    if (sizes.triangle_vertices > context->DYNAMIC_VERTEX_FRAME_SIZE) {
+        overflow |= OVERFLOW_VERTICES;
+    }
+
+    if (!direct) {
+        // Aligned the way StagingPush aligns each push
+        VkDeviceSize used = (context->staging_frame_used[frame] + 15) & ~15ull;
+        used = (used + sizes.all_instances + 15) & ~15ull;
+        if (used + sizes.triangle_vertices > context->staging_frame_capacity) {
+            overflow |= OVERFLOW_INSTANCES | OVERFLOW_VERTICES;
+        }
+    }
+    return overflow;
+}
+
+// Drops the entries drawn last, from the batches whose kind overflows,
+// until the frame fits. Each trimmed batch is the last one of its kind
+// that is left, so the other batches keep their first.
+void TrimDrawBatches(VulkanContext* context, uint32_t frame, bool direct,
+                     uint32_t* instance_count, uint32_t* sprite_count,
+                     uint32_t* triangle_vertex_count) {
+    uint32_t dropped = 0;
+    uint32_t overflow = GetDynamicFrameOverflow(
+        context, frame, direct,
+        GetDynamicFrameSizes(*instance_count, *sprite_count,
+                             *triangle_vertex_count));
+
+    for (uint32_t b = context->draw_batch_count; overflow && b-- > 0;) {
+        DrawBatch* draw = &context->draw_batches[b];
+
+        uint32_t* count;
+        uint32_t per_entry = 1;
+        switch (draw->pipeline) {
+            case PIPELINE_INSTANCED:
+                count = instance_count;
+                break;
+            case PIPELINE_SPRITES:
+                count = sprite_count;
+                break;
+            case PIPELINE_TRIANGLES:
+                count = triangle_vertex_count;
+                per_entry = 3;
+                break;
+            default:
+                continue;
+        }
+        uint32_t kind = draw->pipeline == PIPELINE_TRIANGLES
+                            ? OVERFLOW_VERTICES
+                            : OVERFLOW_INSTANCES;
+
+        while ((overflow & kind) && draw->entry_count > 0) {
+            draw->entry_count--;
+            draw->count -= per_entry;
+            *count -= per_entry;
+            dropped++;
+
+            overflow = GetDynamicFrameOverflow(
+                context, frame, direct,
+                GetDynamicFrameSizes(*instance_count, *sprite_count,
+                                     *triangle_vertex_count));
+        }
+    }
+
+    static bool warned = false;
+    if (dropped && !warned) {
+        fprintf(stderr, "Frame too large, dropped %u entries\n", dropped);
+        warned = true;
+    }
 }
 
-// NOTE: THIS WILL NOT WORK PROPERLY BECAUSE ITS NOT SORTED OR PROCESSED
-// WHATSOEVER
+// Entries are sorted by key, then runs sharing a pipeline and mesh become one
+// DrawBatch each. Instances and triangle vertices are written in sorted
+// order, so consecutive runs on different layers still merge into one draw.
 void UploadPushBufferContentsToGPU(VulkanContext* context, PushBuffer* pb,
-                                   MemoryArena* arena) {
-    temp_arena tmp = begin_temp_arena(arena);
+                                   uint32_t frame) {
+    const uint32_t ENTRIES_PER_JOB = 4096;
+
+    context->draw_batch_count = 0;
+    context->gpu_particles_this_frame = false;
 
     uint32_t number_of_entries = pb->number_of_entries;
+    if (number_of_entries == 0) {
+        return;
+    }
+
+    // NOTE: Per-frame temporaries go to the thread's scratch arena, the
+    // renderer arena only holds what lives as long as the renderer
+    ScratchScope frame_scratch;
+
+    PushBufferEntry* entries = (PushBufferEntry*)pb->arena.base;
+
+    SortEntry* keys = (SortEntry*)arena_push(
+        frame_scratch.arena, sizeof(SortEntry) * number_of_entries);
+    SortEntry* scratch = (SortEntry*)arena_push(
+        frame_scratch.arena, sizeof(SortEntry) * number_of_entries);
 
-    InstanceData* all_instances = (InstanceData*)arena_push(
-        tmp.parent, sizeof(InstanceData) * number_of_entries);
+    // What the camera sees in world space, and the screen itself
+    const RenderCamera* camera = &pb->camera;
+    float screen_width = (float)context->swapchain_extent.width;
+    float screen_height = (float)context->swapchain_extent.height;
+    CullRect world_view = {camera->x, camera->y,
+                           camera->x + screen_width / camera->zoom,
+                           camera->y + screen_height / camera->zoom};
+    CullRect screen_view = {0.0f, 0.0f, screen_width, screen_height};
+
+    uint32_t visible_count;
+    {
+        PROFILE_SCOPE("CullPushBufferEntries");
+        visible_count =
+            CullPushBufferEntries(pb, entries, number_of_entries, &world_view,
+                                  &screen_view, keys);
+    }
+    if (visible_count == 0) {
+        return;
+    }
 
-    for (size_t i = 0; i < number_of_entries; i++) {
-        PushBufferEntry* pbe =
-            (PushBufferEntry*)(pb->arena.base + i * sizeof(PushBufferEntry));
+    // NOTE: Depth is the submission index, the entries are already in depth
+    // order and the sort is stable, so only layer/pipeline/mesh are sorted
+    SortEntry* sorted;
+    {
+        PROFILE_SCOPE("RadixSortKeys");
+        sorted = RadixSortKeys(keys, scratch, visible_count,
+                               SORT_KEY_DEPTH_BITS / 8, 3);
+    }
 
-        if (pbe->type == QUAD) {
-            if (i == 0) {
-                // First entry, upload vertices
-                CreateVertexBuffer(context);
-                CreateIndexBuffer(context);
+    uint32_t instance_count = 0;
+    uint32_t sprite_count = 0;
+    uint32_t triangle_vertex_count = 0;
+    PushBufferEntry* gpu_particles = 0;
+    DrawBatch* gpu_particle_batch = 0;
+
+    // World layers share the identity. Screen space layers undo the
+    // camera, their model matrix is the inverse of the view.
+    DrawUniforms world = {identity()};
+    uint32_t world_uniform_offset = PushDrawUniforms(context, frame, &world);
+    uint32_t screen_uniform_offset = UINT32_MAX;
+
+    DrawBatch* batch = 0;
+    for (uint32_t i = 0; i < visible_count; i++) {
+        PushBufferEntry* pbe = &entries[sorted[i].index];
+        RenderPipelineId pipeline = SortKeyPipeline(sorted[i].key);
+        StaticMeshId mesh = SortKeyMesh(sorted[i].key);
+
+        uint32_t uniform_offset = world_uniform_offset;
+        if (IsScreenSpaceLayer(pb, SortKeyLayer(sorted[i].key))) {
+            if (screen_uniform_offset == UINT32_MAX) {
+                DrawUniforms screen = {
+                    multiply(scale(1.0f / camera->zoom, 1.0f / camera->zoom,
+                                   1.0f),
+                             translate(camera->x, camera->y, 0.0f))};
+                screen_uniform_offset =
+                    PushDrawUniforms(context, frame, &screen);
             }
+            uniform_offset = screen_uniform_offset;
+        }
 
-            InstanceData instance;
+        if (pbe->type == NONE) {
+            continue;
+        }
+
+        if (pipeline == PIPELINE_GPU_PARTICLES) {
+            // Simulated once per frame, the last entry wins
+            if (gpu_particles) {
+                continue;
+            }
+            gpu_particles = pbe;
+        }
 
-            float x = pbe->data.quad.x;
-            float y = pbe->data.quad.y;
+        if (pipeline == PIPELINE_STATIC_LAYER &&
+            !UpdateStaticLayer(context, pb, pbe, frame)) {
+            continue;
+        }
 
-            instance.transform = multiply(
-                scale(pbe->data.quad.width, pbe->data.quad.height, 1.0f),
-                translate(x, y, 0.0f));
-            instance.color = {
-                pbe->color[0],
-                pbe->color[1],
-                pbe->color[2],
-            };
+        if (!batch || batch->pipeline != pipeline || batch->mesh != mesh ||
+            batch->uniform_offset != uniform_offset ||
+            pipeline == PIPELINE_GPU_PARTICLES ||
+            pipeline == PIPELINE_STATIC_LAYER ||
+            batch->first_entry + batch->entry_count != i) {
+            assert(context->draw_batch_count < context->MAX_DRAW_BATCHES);
+            batch = &context->draw_batches[context->draw_batch_count++];
+            batch->pipeline = pipeline;
+            batch->mesh = mesh;
+            batch->first_entry = i;
+            batch->entry_count = 0;
+            batch->count = 0;
+            batch->uniform_offset = uniform_offset;
+
+            switch (pipeline) {
+                case PIPELINE_INSTANCED:
+                    batch->first = instance_count;
+                    break;
+                case PIPELINE_SPRITES:
+                    batch->first = sprite_count;
+                    break;
+                case PIPELINE_TRIANGLES:
+                    batch->first = triangle_vertex_count;
+                    break;
+                case PIPELINE_STATIC_LAYER:
+                    batch->first = pbe->data.static_layer.id;
+                    break;
+                default:
+                    batch->first = 0;
+                    break;
+            }
+        }
 
-            all_instances[i] = instance;
+        batch->entry_count++;
+        switch (pipeline) {
+            case PIPELINE_INSTANCED:
+                batch->count++;
+                instance_count++;
+                break;
+            case PIPELINE_SPRITES:
+                batch->count++;
+                sprite_count++;
+                break;
+            case PIPELINE_TRIANGLES:
+                batch->count += 3;
+                triangle_vertex_count += 3;
+                break;
+            case PIPELINE_STATIC_LAYER:
+                break;
+            default:
+                // Sized below, once the live window is known
+                gpu_particle_batch = batch;
+                break;
         }
     }
 
-    if (number_of_entries > 0) {
-        VkDeviceSize all_instances_size =
-            sizeof(InstanceData) * number_of_entries;
-        assert(all_instances_size <= context->MAX_INSTANCE_BUFFER_SIZE);
-        context->instance_buffer_size += all_instances_size;
-        memcpy(context->staging_buffer_mapped, all_instances,
-               all_instances_size);
-        CopyBuffer(context, context->staging_buffer,
-                   context->device_memory_buffer, all_instances_size,
-                   context->instance_buffer_offset);
+    PrepareParticleSimulation(context, gpu_particles);
+    if (gpu_particle_batch && context->gpu_particles_this_frame) {
+        gpu_particle_batch->first = context->gpu_particle_params.simulate_start;
+        gpu_particle_batch->count = context->gpu_particle_params.simulate_count;
+    }
+
+    // Jobs write straight into mapped memory, each into its own range, so
+    // there is no intermediate copy. Directly into the buffer the GPU
+    // reads when possible, otherwise into the staging slice.
+    bool direct = context->direct_upload_supported;
+    TrimDrawBatches(context, frame, direct, &instance_count, &sprite_count,
+                    &triangle_vertex_count);
+
+    // Sprite instances have their own stride, they follow the plain ones
+    DynamicFrameSizes sizes =
+        GetDynamicFrameSizes(instance_count, sprite_count,
+                             triangle_vertex_count);
+    VkDeviceSize sprites_offset = sizes.sprites_offset;
+    VkDeviceSize all_instances_size = sizes.all_instances;
+    VkDeviceSize triangle_vertices_size = sizes.triangle_vertices;
+
+    VkDeviceSize instances_staging_offset = 0;
+    VkDeviceSize vertices_staging_offset = 0;
+    InstanceData2D* all_instances = 0;
+    ColorVertex2D* triangle_vertices = 0;
+    if (direct) {
+        VkDeviceSize frame_base =
+            frame * (context->INSTANCE_FRAME_SIZE +
+                     context->DYNAMIC_VERTEX_FRAME_SIZE);
+        VkDeviceSize vertex_base = frame_base + context->INSTANCE_FRAME_SIZE;
+
+        all_instances =
+            (InstanceData2D*)(context->direct_buffer_mapped + frame_base);
+        triangle_vertices =
+            (ColorVertex2D*)(context->direct_buffer_mapped + vertex_base);
+
+        context->instance_bind_buffer = context->direct_buffer;
+        context->instance_bind_offset = frame_base;
+        context->dynamic_vertex_bind_buffer = context->direct_buffer;
+        context->dynamic_vertex_bind_offset = vertex_base;
+    } else {
+        if (all_instances_size) {
+            all_instances = (InstanceData2D*)StagingPush(
+                context, frame, all_instances_size, &instances_staging_offset);
+        }
+        if (triangle_vertices_size) {
+            triangle_vertices = (ColorVertex2D*)StagingPush(
+                context, frame, triangle_vertices_size,
+                &vertices_staging_offset);
+        }
+
+        context->instance_bind_buffer = context->frame_instance_buffers[frame];
+        context->instance_bind_offset = 0;
+        context->dynamic_vertex_bind_buffer =
+            context->frame_vertex_buffers[frame];
+        context->dynamic_vertex_bind_offset = 0;
+    }
+
+    SpriteInstance2D* sprite_instances =
+        (SpriteInstance2D*)((uint8_t*)all_instances + sprites_offset);
+    context->sprite_bind_offset =
+        context->instance_bind_offset + sprites_offset;
+
+    uint32_t job_count = 0;
+    for (uint32_t b = 0; b < context->draw_batch_count; b++) {
+        DrawBatch* draw = &context->draw_batches[b];
+        if (draw->pipeline == PIPELINE_INSTANCED ||
+            draw->pipeline == PIPELINE_SPRITES ||
+            draw->pipeline == PIPELINE_TRIANGLES) {
+            job_count +=
+                (draw->entry_count + ENTRIES_PER_JOB - 1) / ENTRIES_PER_JOB;
+        }
+    }
+
+    Job* jobs =
+        (Job*)arena_push(frame_scratch.arena, sizeof(Job) * job_count);
+    ConvertEntriesJob* job_data = (ConvertEntriesJob*)arena_push(
+        frame_scratch.arena, sizeof(ConvertEntriesJob) * job_count);
+
+    uint32_t job_index = 0;
+    for (uint32_t b = 0; b < context->draw_batch_count; b++) {
+        DrawBatch* draw = &context->draw_batches[b];
+        if (draw->pipeline != PIPELINE_INSTANCED &&
+            draw->pipeline != PIPELINE_SPRITES &&
+            draw->pipeline != PIPELINE_TRIANGLES) {
+            continue;
+        }
+
+        for (uint32_t first = 0; first < draw->entry_count;
+             first += ENTRIES_PER_JOB) {
+            ConvertEntriesJob* data = &job_data[job_index];
+            data->entries = entries;
+            data->sorted = sorted + draw->first_entry + first;
+            data->count = SDL_min(ENTRIES_PER_JOB, draw->entry_count - first);
+            data->pipeline = draw->pipeline;
+            data->sprites = &context->sprites;
+            switch (draw->pipeline) {
+                case PIPELINE_INSTANCED:
+                    data->output = all_instances + draw->first + first;
+                    break;
+                case PIPELINE_SPRITES:
+                    data->output = sprite_instances + draw->first + first;
+                    break;
+                default:
+                    data->output =
+                        triangle_vertices + draw->first + first * 3;
+                    break;
+            }
+
+            jobs[job_index].func = ConvertPushBufferEntries;
+            jobs[job_index].data = data;
+            job_index++;
+        }
+    }
+
+    JobCounter counter = {};
+    job_system_submit(context->jobs, jobs, job_count, &counter);
+    job_system_wait(context->jobs, &counter);
+
+    // NOTE: Host writes before vkQueueSubmit are visible to the GPU without
+    // a barrier, the direct path needs nothing else
+    if (!direct && all_instances_size) {
+        QueueStagingCopy(context, frame, instances_staging_offset,
+                         all_instances_size,
+                         context->frame_instance_buffers[frame], 0);
+    }
+    if (!direct && triangle_vertices_size) {
+        QueueStagingCopy(context, frame, vertices_staging_offset,
+                         triangle_vertices_size,
+                         context->frame_vertex_buffers[frame], 0);
     }
-    end_temp_arena(&tmp);
 }
 
 void RendererDrawFrame(VulkanContext* context, MemoryArena* arena,
                        PushBuffer* push_buffer) {
     static uint32_t current_frame = 0;
 
-    vkWaitForFences(context->device, 1,
-                    &context->in_flight_fence[current_frame], VK_TRUE,
-                    UINT64_MAX);
+    {
+        PROFILE_SCOPE("WaitForFrameFence");
+        vkWaitForFences(context->device, 1,
+                        &context->in_flight_fence[current_frame], VK_TRUE,
+                        UINT64_MAX);
+    }
     vkResetFences(context->device, 1, &context->in_flight_fence[current_frame]);
 
-    uint32_t swapchain_image_index;
-    VkResult image_result =
-        vkAcquireNextImageKHR(context->device, context->swapchain, UINT64_MAX,
-                              context->image_acquire_semaphore[current_frame],
-                              VK_NULL_HANDLE, &swapchain_image_index);
-
-    if (image_result == VK_ERROR_OUT_OF_DATE_KHR ||
-        image_result == VK_SUBOPTIMAL_KHR) {
-        RecreateSwapchainResources(context, arena);
-        return;
+    // The GPU is done with everything this frame staged last time around
+    ResetFrameStaging(context, current_frame);
+    FreeRetiredBuffers(context, current_frame);
+    CollectGpuZones(context, current_frame);
+
+    // Headless frames own the offscreen image with their own index
+    uint32_t swapchain_image_index = current_frame;
+    if (!context->headless) {
+        PROFILE_SCOPE("AcquireNextImage");
+        VkResult image_result = vkAcquireNextImageKHR(
+            context->device, context->swapchain, UINT64_MAX,
+            context->image_acquire_semaphore[current_frame], VK_NULL_HANDLE,
+            &swapchain_image_index);
+
+        if (image_result == VK_ERROR_OUT_OF_DATE_KHR ||
+            image_result == VK_SUBOPTIMAL_KHR) {
+            RecreateSwapchainResources(context, arena);
+            // Static layer content this frame carried is dropped with it
+            ReportStaticLayers(context, push_buffer);
+            return;
+        }
     }
 
-    UpdateUniformBuffer(context, current_frame);
+    BeginFrameUniforms(context, current_frame, &push_buffer->camera);
 
     // Update Vertex and Index buffers if needed
-    UploadPushBufferContentsToGPU(context, push_buffer, arena);
+    {
+        PROFILE_SCOPE("UploadPushBufferContentsToGPU");
+        UploadPushBufferContentsToGPU(context, push_buffer, current_frame);
+    }
+    ReportStaticLayers(context, push_buffer);
 
     vkResetCommandBuffer(context->command_buffers[current_frame], 0);
     RecordCommandBuffer(context, swapchain_image_index, arena, current_frame,
@@ -1470,14 +3939,34 @@ void RendererDrawFrame(VulkanContext* context, MemoryArena* arena,
         .pSignalSemaphores = signalSemaphores,
     };
 
-    VkResult res = vkQueueSubmit(context->graphics_queue, 1, &submitInfo,
-                                 context->in_flight_fence[current_frame]);
+    if (context->headless) {
+        // Nothing was acquired and nothing will be presented
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.signalSemaphoreCount = 0;
+    }
+
+    if (context->gpu_timestamps_supported) {
+        context->frame_submit_ticks[current_frame] =
+            SDL_GetPerformanceCounter();
+    }
+
+    VkResult res;
+    {
+        PROFILE_SCOPE("QueueSubmit");
+        res = vkQueueSubmit(context->graphics_queue, 1, &submitInfo,
+                            context->in_flight_fence[current_frame]);
+    }
 
     if (res != VK_SUCCESS) {
         fprintf(stderr, "Failed to submit draw command buffer: %s",
                 string_VkResult(res));
     }
 
+    if (context->headless) {
+        current_frame = (current_frame + 1) % context->MAX_FRAMES_IN_FLIGHT;
+        return;
+    }
+
     VkSwapchainKHR swapChains[] = {context->swapchain};
 
     VkPresentInfoKHR presentInfo{
@@ -1492,8 +3981,11 @@ void RendererDrawFrame(VulkanContext* context, MemoryArena* arena,
         .pImageIndices = &swapchain_image_index,
     };
 
-    VkResult present_result =
-        vkQueuePresentKHR(context->present_queue, &presentInfo);
+    VkResult present_result;
+    {
+        PROFILE_SCOPE("QueuePresent");
+        present_result = vkQueuePresentKHR(context->present_queue, &presentInfo);
+    }
 
     if (present_result == VK_ERROR_OUT_OF_DATE_KHR ||
         present_result == VK_SUBOPTIMAL_KHR) {
@@ -4,7 +4,11 @@
 
 #include <SDL3/SDL_stdinc.h>
 
+#include "vkh_gpu_memory.h"
+#include "vkh_jobs.h"
 #include "vkh_math.h"
+#include "vkh_profiler.h"
+#include "vkh_renderer_abstraction.h"
 #include <vulkan/vulkan.h>
 
 struct Vertex {
@@ -15,17 +19,177 @@ struct Vertex2D {
     vec2 pos;
 };
 
-struct UniformBufferObject {
+// Per-frame camera, pushed once per command buffer
+struct ViewPushConstants {
+    mat4 view_proj;
+};
+
+// Per-draw data, read through a UNIFORM_BUFFER_DYNAMIC offset
+struct DrawUniforms {
     mat4 model;
-    mat4 view;
-    mat4 proj;
 };
 
-struct InstanceData {
-    mat4 transform;
-    vec3 color;
+// Per-instance vertex input for 2D rectangles, the unit mesh is scaled by
+// size and moved to position in the vertex shader. 20 bytes per instance.
+struct InstanceData2D {
+    vec2 position;
+    vec2 size;
+    uint32_t color;  // RGBA8, R in the lowest byte
+};
+
+// Per-instance vertex input of PIPELINE_SPRITES. Starts like
+// InstanceData2D, uv_rect is the rectangle sampled as (u0, v0, u1, v1) in
+// 16 bit UNORM and texture the slot in the bindless texture array. With
+// the atlas fallback texture is always 0. 32 bytes per instance.
+struct SpriteInstance2D {
+    vec2 position;
+    vec2 size;
+    uint32_t color;  // RGBA8 tint
+    uint16_t uv_rect[4];
+    uint32_t texture;
+};
+
+// Per sprite instance data, filled in by whichever texture path is in use
+struct SpriteTable {
+    uint16_t uv_rects[SPRITE_MAX][4];
+    uint32_t textures[SPRITE_MAX];
+};
+
+// Where a sprite landed in the atlas, in texels
+struct AtlasRegion {
+    uint32_t x, y;
+    uint32_t width, height;
+};
+
+// NOTE: Every sprite lives in one RGBA8 image so sprites with different
+// images still draw in one instanced call. Packed once at init, shelf by
+// shelf, tallest images first.
+struct TextureAtlas {
+    VkImage image;
+    VkImageView view;
+    VkSampler sampler;
+    GpuAllocation allocation;
+    uint32_t width, height;
+    AtlasRegion regions[SPRITE_MAX];
+};
+
+// Slots in the bindless array. Must match the array size in
+// sprite_bindless.frag.
+const uint32_t BINDLESS_TEXTURE_CAPACITY = 1024;
+
+// NOTE: With descriptor indexing every sprite keeps its own image and the
+// fragment shader picks it out of one partially bound sampler array by the
+// instance's texture slot. New textures only need a free slot, never a new
+// layout, pipeline or a split batch. Slot i holds SpriteId i for now.
+struct BindlessTextures {
+    VkImage images[SPRITE_MAX];
+    VkImageView views[SPRITE_MAX];
+    GpuAllocation allocations[SPRITE_MAX];
+    VkSampler sampler;
+};
+
+// Each static mesh owns its vertex and index buffer, sub-allocated from
+// the GPU allocator so meshes can be removed and replaced at runtime
+struct StaticMesh {
+    VkBuffer vertex_buffer;
+    VkBuffer index_buffer;
+    GpuAllocation vertex_allocation;
+    GpuAllocation index_allocation;
+    uint32_t index_count;
+};
+
+// A staging -> device buffer copy recorded at the start of a frame
+struct PendingCopy {
+    VkBuffer dst;
+    VkBufferCopy region;
+};
+
+// Vertex of the PIPELINE_TRIANGLES path, expanded from TRIANGLE entries
+// every frame
+struct ColorVertex2D {
+    vec2 pos;
+    uint32_t color;  // RGBA8, R in the lowest byte
 };
 
+// One draw after sorting: a run of entries that share pipeline and mesh.
+// first/count are instances, or vertices for PIPELINE_TRIANGLES. A
+// PIPELINE_STATIC_LAYER batch draws the resident layer whose id is first.
+// A PIPELINE_GPU_PARTICLES batch draws the live window of the particle
+// ring, which may wrap around its end.
+struct DrawBatch {
+    RenderPipelineId pipeline;
+    StaticMeshId mesh;
+    uint32_t first_entry;  // into the sorted entry order
+    uint32_t entry_count;
+    uint32_t first;
+    uint32_t count;
+    uint32_t uniform_offset;  // dynamic offset of its DrawUniforms
+};
+
+const uint32_t STATIC_LAYER_MAX_BATCHES = 64;
+
+// NOTE: A static layer converted once and kept in device memory. Plain
+// instances, sprite instances and triangle vertices share one buffer, the
+// batches index into it like a frame's batches index into the frame
+// buffers. Resident content isn't culled, the GPU clips what's off screen.
+struct StaticLayerResident {
+    bool valid;
+    uint64_t hash;  // of the push buffer entries it was built from
+    VkBuffer buffer;
+    GpuAllocation allocation;
+    VkDeviceSize sprite_offset;
+    VkDeviceSize vertex_offset;
+    DrawBatch batches[STATIC_LAYER_MAX_BATCHES];
+    uint32_t batch_count;
+};
+
+// Replaced static layer buffer, frames in flight may still draw from it
+struct RetiredBuffer {
+    VkBuffer buffer;
+    GpuAllocation allocation;
+};
+
+// Pair of timestamp queries around a stretch of one frame's commands
+struct GpuProfileZone {
+    const char* name;
+    uint32_t begin_query;
+    uint32_t end_query;
+};
+
+// Storage buffer layout of particles.comp (std430). The first 20 bytes
+// match InstanceData2D so the buffer can be bound as instance input.
+struct GpuParticle {
+    vec2 position;
+    vec2 size;
+    uint32_t color;
+    float life;
+    vec2 velocity;
+};
+
+// Push constants of particles.comp
+struct GpuParticleParams {
+    vec2 emitter_position;
+    float delta_time;
+    float lifetime;
+    float speed;
+    uint32_t spawn_start;
+    uint32_t spawn_count;
+    uint32_t capacity;
+    uint32_t seed;
+    uint32_t simulate_start;  // live window, only it is dispatched
+    uint32_t simulate_count;
+};
+
+// Particles spawned in one frame, all dead once the simulation clock is
+// max_life past clock
+struct GpuParticleSpawn {
+    uint32_t count;
+    float max_life;
+    double clock;  // simulation clock after the spawning dispatch
+};
+
+const uint32_t GPU_PARTICLE_SPAWN_HISTORY = 256;
+
 struct queue_indices {
     uint32_t* graphics;
     uint32_t* present;
@@ -45,6 +209,7 @@ struct VulkanFuncTable {
     PFN_vkCmdBeginRenderingKHR vkCmdBeginRenderingKHR = 0;
     PFN_vkCmdEndRenderingKHR vkCmdEndRenderingKHR = 0;
     PFN_vkCmdPipelineBarrier2KHR vkCmdPipelineBarrier2KHR = 0;
+    PFN_vkCmdWriteTimestamp2KHR vkCmdWriteTimestamp2KHR = 0;
 };
 
 struct VulkanContext {
@@ -56,6 +221,11 @@ struct VulkanContext {
 
     VkPhysicalDeviceProperties2 physical_device_properties2;
 
+    // NOTE: Seeded from PIPELINE_CACHE_PATH at startup and written back once
+    // every pipeline exists, so later launches skip the driver's shader
+    // compiles.
+    VkPipelineCache pipeline_cache;
+
     int WindowDrawableAreaWidth;
     int WindowDrawableAreaHeight;
     float WindowPixelDensity;
@@ -64,6 +234,21 @@ struct VulkanContext {
 
     VulkanFuncTable func_table;
 
+    // Owned by the platform layer, used to convert push buffers in parallel
+    JobSystem* jobs;
+
+    // NOTE: Headless mode has no surface or swapchain. Offscreen images,
+    // one per frame in flight, stand in for the swapchain images and
+    // frames are never presented.
+    bool headless;
+    GpuAllocation* offscreen_image_allocations;
+
+    // Headless frame dump, filled by the frame after RendererRequestCapture
+    bool capture_requested;
+    VkBuffer capture_buffer;
+    GpuAllocation capture_buffer_allocation;
+    void* capture_buffer_mapped;
+
     VkSwapchainKHR old_swapchain = VK_NULL_HANDLE;
     VkSwapchainKHR swapchain;
     VkFormat swapchain_format;
@@ -80,30 +265,75 @@ struct VulkanContext {
     VkSemaphore* render_finished_semaphore;
     VkFence* in_flight_fence;
 
-    const uint64_t MAX_DEVICE_MEMORY_ALLOCATION_SIZE =
-        1024 * 1024 * 1024;                                       // 1 GB
-    const uint64_t MAX_VERTEX_BUFFER_SIZE = 1024 * 1024 * 256;    // 256 MB
-    const uint64_t MAX_INDEX_BUFFER_SIZE = 1024 * 1024 * 256;     // 256 MB
-    const uint64_t MAX_INSTANCE_BUFFER_SIZE = 1024 * 1024 * 256;  // 256 MB
-
-    VkBuffer device_memory_buffer;
-    VkDeviceMemory device_memory_buffer_memory;
-    VkDeviceSize vertex_buffer_offset = 0;
-    VkDeviceSize vertex_buffer_size = 0;
-    VkDeviceSize index_buffer_offset = MAX_VERTEX_BUFFER_SIZE + 4;
-    VkDeviceSize index_buffer_size = 0;
-    VkDeviceSize instance_buffer_offset =
-        MAX_VERTEX_BUFFER_SIZE + MAX_INDEX_BUFFER_SIZE + 4;
-    VkDeviceSize instance_buffer_size = 0;
-
-    const uint64_t STAGING_BUFFER_SIZE = 1024 * 1024 * 64;  // 64 MB
+    // NOTE: Every buffer and image is sub-allocated from large device
+    // memory blocks, see vkh_gpu_memory.h
+    GpuAllocator* gpu_allocator;
+
+    // NOTE: Instances and TRIANGLE vertices are rewritten every frame. Each
+    // frame in flight has its own buffers, only rewritten after its frame's
+    // in_flight_fence signalled, so consecutive frames never touch the same
+    // bytes and can overlap on the GPU. Sized for MAX_FRAME_INSTANCES of
+    // the largest instance type, only created without direct upload.
+    const uint64_t INSTANCE_FRAME_SIZE =
+        MAX_FRAME_INSTANCES * sizeof(SpriteInstance2D);          // 16 MB
+    const uint64_t DYNAMIC_VERTEX_FRAME_SIZE = 1024 * 1024 * 8;  // 8 MB
+    VkBuffer* frame_instance_buffers;
+    GpuAllocation* frame_instance_allocations;
+    VkBuffer* frame_vertex_buffers;
+    GpuAllocation* frame_vertex_allocations;
+
+    // NOTE: With resizable BAR or unified memory there is a DEVICE_LOCAL |
+    // HOST_VISIBLE memory type. Conversion jobs then write straight into
+    // this persistently mapped buffer, one slice per frame in flight of
+    // the same sizes as above, and no copy is recorded.
+    bool direct_upload_supported;
+    VkBuffer direct_buffer;
+    GpuAllocation direct_buffer_allocation;
+    uint8_t* direct_buffer_mapped;
+
+    // Where this frame's instances and triangle vertices were written
+    VkBuffer instance_bind_buffer;
+    VkDeviceSize instance_bind_offset;
+    VkBuffer dynamic_vertex_bind_buffer;
+    VkDeviceSize dynamic_vertex_bind_offset;
+
+    StaticMesh static_meshes[STATIC_MESH_MAX];
+    // Sprites sample the bindless texture array when the device reports
+    // descriptor indexing, the atlas otherwise
+    bool bindless_supported;
+    TextureAtlas atlas;
+    BindlessTextures bindless_textures;
+    SpriteTable sprites;
+
+    // Sprite instances follow the InstanceData2D ones in the instance
+    // buffers, from this offset on
+    VkDeviceSize sprite_bind_offset;
+
     VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
+    VkDeviceSize staging_buffer_size;
+    GpuAllocation staging_buffer_allocation;
     void* staging_buffer_mapped;
 
+    // NOTE: The staging buffer is a ring with one slice per frame in flight.
+    // A slice is only reused after that frame's in_flight_fence signalled, so
+    // copies can be recorded into the frame's own command buffer. It holds a
+    // full frame of instances and vertices plus the frame's other uploads.
+    const uint64_t STAGING_FRAME_SIZE = 1024 * 1024 * 32;  // 32 MB
+    const uint32_t MAX_PENDING_COPIES = 64;
+    VkDeviceSize staging_frame_capacity;
+    VkDeviceSize* staging_frame_used;
+    PendingCopy** pending_copies;
+    uint32_t* pending_copy_count;
+
+    // NOTE: Per-draw uniforms live in a small ring, one buffer per frame in
+    // flight, and are selected with a dynamic offset at bind time
+    const uint32_t MAX_DRAW_UNIFORMS = 1024;
+    VkDeviceSize draw_uniform_stride;  // minUniformBufferOffsetAlignment
+    uint32_t* draw_uniform_count;
     VkBuffer* uniform_buffers;
-    VkDeviceMemory* uniform_buffers_memory;
+    GpuAllocation* uniform_buffer_allocations;
     void** uniform_buffers_mapped;
+    ViewPushConstants view_constants;
 
     VkCommandPool command_pool;
     VkCommandBuffer* command_buffers;
@@ -112,5 +342,51 @@ struct VulkanContext {
     VkDescriptorSetLayout descriptor_set_layout;
     VkDescriptorSet* descriptor_sets;
     VkPipelineLayout pipeline_layout;
-    VkPipeline graphics_pipeline;
+    VkPipeline pipelines[RENDER_PIPELINE_MAX];
+
+    // Rebuilt from the sorted push buffer every frame
+    const uint32_t MAX_DRAW_BATCHES = 4096;
+    DrawBatch* draw_batches;
+    uint32_t draw_batch_count;
+
+    // Retained layers, only re-uploaded when their content hash changes.
+    // Replaced buffers are freed once the frame that retired them comes
+    // round again, after its fence.
+    const uint32_t MAX_RETIRED_BUFFERS = 16;
+    StaticLayerResident static_layers[STATIC_LAYER_MAX];
+    RetiredBuffer** retired_buffers;
+    uint32_t* retired_buffer_count;
+
+    // GPU profiling, one timestamp query pool per frame in flight. Results
+    // are read after the frame's fence signalled, so reading never stalls.
+    const uint32_t MAX_GPU_PROFILE_ZONES = 16;
+    bool gpu_timestamps_supported;
+    float timestamp_period;  // nanoseconds per tick
+    uint64_t timestamp_mask;
+    VkQueryPool* timestamp_query_pools;
+    GpuProfileZone** gpu_profile_zones;
+    uint32_t* gpu_profile_zone_count;
+    uint64_t* frame_submit_ticks;  // CPU ticks when the frame was submitted
+
+    // GPU particle simulation, particle state never leaves device memory
+    const uint32_t GPU_PARTICLE_CAPACITY = 1 << 20;
+    bool gpu_particles_supported;
+    bool gpu_particles_this_frame;
+    uint32_t gpu_particle_spawn_cursor;
+    // NOTE: Spawns that may still have live particles, oldest first. Slots
+    // are handed out in ring order, so everything outside the last
+    // gpu_particle_live_count slots before the cursor is dead and neither
+    // simulated nor drawn.
+    GpuParticleSpawn gpu_particle_spawns[GPU_PARTICLE_SPAWN_HISTORY];
+    uint32_t gpu_particle_spawn_first;
+    uint32_t gpu_particle_spawn_count;
+    uint32_t gpu_particle_live_count;
+    double gpu_particle_clock;  // sum of every dispatched delta_time
+    GpuParticleParams gpu_particle_params;
+    VkBuffer gpu_particle_buffer;
+    GpuAllocation gpu_particle_buffer_allocation;
+    VkDescriptorSetLayout particle_descriptor_set_layout;
+    VkDescriptorSet particle_descriptor_set;
+    VkPipelineLayout particle_compute_layout;
+    VkPipeline particle_compute_pipeline;
 };
@@ -1,11 +1,49 @@
 #include "vkh_renderer_abstraction.h"
 
+#include <string.h>
+
+// Entries go to the open static layer's content if there is one. Static
+// content is zeroed first, padding included, so it hashes the same every
+// time it is drawn the same.
+inline PushBufferEntry* PushEntry(PushBuffer* pb, PushBufferEntryType type,
+                                  RenderPipelineId pipeline,
+                                  StaticMeshId mesh) {
+    PushBufferEntry* pbe;
+    uint32_t depth;
+    if (pb->open_static_layer) {
+        pbe = (PushBufferEntry*)arena_push(&pb->static_arena,
+                                           sizeof(PushBufferEntry));
+        memset(pbe, 0, sizeof(PushBufferEntry));
+        depth = pb->number_of_static_entries++;
+    } else {
+        pbe = (PushBufferEntry*)arena_push(&pb->arena, sizeof(PushBufferEntry));
+        depth = pb->number_of_entries++;
+    }
+
+    pbe->type = type;
+    pbe->mesh = mesh;
+    pbe->sort_key = MakeSortKey(pb->current_layer, pipeline, mesh, depth);
+    return pbe;
+}
+
+// Everything drawn after this lands on layer, lower layers are drawn first
+inline void SetLayer(PushBuffer* pb, uint8_t layer) {
+    pb->current_layer = layer;
+}
+
+// Entries on layer are positioned in screen pixels, e.g. backgrounds and
+// the cursor, everything else goes through the camera
+inline void SetLayerScreenSpace(PushBuffer* pb, uint8_t layer) {
+    pb->screen_space_layers[layer >> 6] |= 1ull << (layer & 63);
+}
+
+inline void SetCamera(PushBuffer* pb, float x, float y, float zoom) {
+    pb->camera = {x, y, zoom};
+}
+
 inline void DrawRectangle(PushBuffer* pb, float x, float y, float width,
                           float height, float r, float g, float b) {
-    PushBufferEntry* pbe =
-        (PushBufferEntry*)arena_push(&pb->arena, sizeof(PushBufferEntry));
-
-    pbe->type = QUAD;
+    PushBufferEntry* pbe = PushEntry(pb, QUAD, PIPELINE_INSTANCED, MESH_QUAD);
     pbe->data.quad.x = x;
     pbe->data.quad.y = y;
     pbe->data.quad.width = width;
@@ -14,8 +52,117 @@ inline void DrawRectangle(PushBuffer* pb, float x, float y, float width,
     pbe->color[0] = r;
     pbe->color[1] = g;
     pbe->color[2] = b;
+}
+
+inline void DrawTriangle(PushBuffer* pb, float x1, float y1, float x2,
+                         float y2, float x3, float y3, float r, float g,
+                         float b) {
+    PushBufferEntry* pbe =
+        PushEntry(pb, TRIANGLE, PIPELINE_TRIANGLES, MESH_TRIANGLE);
+    pbe->data.triangle.x1 = x1;
+    pbe->data.triangle.y1 = y1;
+    pbe->data.triangle.x2 = x2;
+    pbe->data.triangle.y2 = y2;
+    pbe->data.triangle.x3 = x3;
+    pbe->data.triangle.y3 = y3;
+
+    pbe->color[0] = r;
+    pbe->color[1] = g;
+    pbe->color[2] = b;
+}
+
+// Draws the atlas image id stretched over the rectangle, tinted by r, g, b.
+// Sprites on a layer go out in one instanced draw whatever their id.
+inline void DrawSprite(PushBuffer* pb, SpriteId id, float x, float y,
+                       float width, float height, float r, float g, float b) {
+    PushBufferEntry* pbe = PushEntry(pb, SPRITE, PIPELINE_SPRITES, MESH_QUAD);
+    pbe->data.sprite.x = x;
+    pbe->data.sprite.y = y;
+    pbe->data.sprite.width = width;
+    pbe->data.sprite.height = height;
+    pbe->data.sprite.id = id;
+
+    pbe->color[0] = r;
+    pbe->color[1] = g;
+    pbe->color[2] = b;
+}
+
+// Simulates and draws the renderer's GPU particle system this frame, at most
+// one per push buffer. Particle state never leaves the GPU.
+inline void DrawGPUParticles(PushBuffer* pb, float x, float y,
+                             float delta_time, uint32_t spawn_count,
+                             float lifetime, float speed) {
+    // The simulation steps every frame, it can't be retained
+    ASSERT(!pb->open_static_layer);
+    PushBufferEntry* pbe =
+        PushEntry(pb, GPU_PARTICLES, PIPELINE_GPU_PARTICLES, MESH_QUAD);
+    pbe->data.gpu_particles.x = x;
+    pbe->data.gpu_particles.y = y;
+    pbe->data.gpu_particles.delta_time = delta_time;
+    pbe->data.gpu_particles.spawn_count = spawn_count;
+    pbe->data.gpu_particles.lifetime = lifetime;
+    pbe->data.gpu_particles.speed = speed;
+}
+
+// FNV-1a over the raw entries, PushEntry zeroes static content so equal
+// content hashes equal
+inline uint64_t HashPushBufferEntries(const PushBufferEntry* entries,
+                                      uint32_t count) {
+    const uint8_t* bytes = (const uint8_t*)entries;
+    size_t size = sizeof(PushBufferEntry) * count;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Draws a reference to the static layer on the current layer. Returns true
+// when the layer is dirty, the caller then draws its whole content before
+// EndStaticLayer. Otherwise the renderer draws what it kept resident and
+// the caller draws nothing.
+inline bool BeginStaticLayer(PushBuffer* pb, StaticLayer* layer) {
+    ASSERT(!pb->open_static_layer);
+    ASSERT(layer->id < STATIC_LAYER_MAX);
+
+    // NOTE: A frame carrying the content can be dropped, e.g. when the
+    // swapchain is out of date. The hashes come back one push buffer late,
+    // so right after a change the content is sent twice, the renderer
+    // skips the second upload.
+    if (pb->resident_static_hashes[layer->id] != layer->hash) {
+        layer->dirty = true;
+    }
+
+    PushBufferEntry* pbe =
+        PushEntry(pb, STATIC_LAYER, PIPELINE_STATIC_LAYER, MESH_QUAD);
+    pbe->data.static_layer.id = layer->id;
+    pbe->data.static_layer.has_content = layer->dirty;
+    pbe->data.static_layer.first_entry = pb->number_of_static_entries;
+    pbe->data.static_layer.entry_count = 0;
+    pbe->data.static_layer.hash = layer->hash;
+
+    if (layer->dirty) {
+        pb->open_static_layer = pbe;
+    }
+    return layer->dirty;
+}
+
+inline void EndStaticLayer(PushBuffer* pb, StaticLayer* layer) {
+    PushBufferEntry* pbe = pb->open_static_layer;
+    if (!pbe) {
+        return;
+    }
+
+    uint32_t first = pbe->data.static_layer.first_entry;
+    uint32_t count = pb->number_of_static_entries - first;
+    PushBufferEntry* content = (PushBufferEntry*)pb->static_arena.base + first;
 
-    pb->number_of_entries++;
+    // 0 stands for nothing resident
+    uint64_t hash = HashPushBufferEntries(content, count);
+    pbe->data.static_layer.entry_count = count;
+    pbe->data.static_layer.hash = hash ? hash : 1;
 
-    return;
+    layer->hash = pbe->data.static_layer.hash;
+    layer->dirty = false;
+    pb->open_static_layer = 0;
 }
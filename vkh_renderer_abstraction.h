@@ -6,12 +6,69 @@ enum PushBufferEntryType {
     NONE,
     TRIANGLE,
     QUAD,
+    GPU_PARTICLES,
+    SPRITE,
+    STATIC_LAYER,
 
     PUSH_BUFFER_ENTRY_TYPE_MAX,
 };
 
+// Unit meshes uploaded once by the renderer at init
+enum StaticMeshId {
+    MESH_QUAD,
+    MESH_TRIANGLE,
+
+    STATIC_MESH_MAX,
+};
+
+// Pipelines the renderer can batch entries into. The value is part of the
+// sort key, so this is also the draw order inside a layer.
+enum RenderPipelineId {
+    PIPELINE_INSTANCED,
+    PIPELINE_TRIANGLES,
+    PIPELINE_GPU_PARTICLES,
+    PIPELINE_SPRITES,
+    // Not a pipeline, draws a retained layer's own batches out of its
+    // resident buffer
+    PIPELINE_STATIC_LAYER,
+
+    RENDER_PIPELINE_MAX,
+};
+
+// Images packed into the renderer's texture atlas at init, see SPRITE_PATHS
+// in vkh_renderer.cpp
+enum SpriteId {
+    SPRITE_TILE,
+    SPRITE_HEART,
+
+    SPRITE_MAX,
+};
+
+// Sort key layout, most significant first:
+// layer (8) | pipeline (8) | mesh (8) | depth (40)
+// Depth is the submission index, so equal keys keep the order they were
+// pushed in.
+const uint32_t SORT_KEY_DEPTH_BITS = 40;
+const uint64_t SORT_KEY_DEPTH_MASK = (1ull << SORT_KEY_DEPTH_BITS) - 1;
+
+inline uint64_t MakeSortKey(uint8_t layer, RenderPipelineId pipeline,
+                            StaticMeshId mesh, uint64_t depth) {
+    return ((uint64_t)layer << 56) | ((uint64_t)(uint8_t)pipeline << 48) |
+           ((uint64_t)(uint8_t)mesh << 40) | (depth & SORT_KEY_DEPTH_MASK);
+}
+
+inline uint8_t SortKeyLayer(uint64_t key) { return (uint8_t)(key >> 56); }
+inline RenderPipelineId SortKeyPipeline(uint64_t key) {
+    return (RenderPipelineId)(uint8_t)(key >> 48);
+}
+inline StaticMeshId SortKeyMesh(uint64_t key) {
+    return (StaticMeshId)(uint8_t)(key >> 40);
+}
+
 struct PushBufferEntry {
     PushBufferEntryType type;
+    StaticMeshId mesh;
+    uint64_t sort_key;
     union {
         struct {
             float x, y;           // Top-left corner
@@ -22,11 +79,73 @@ struct PushBufferEntry {
             float x2, y2;  // Vertex 2
             float x3, y3;  // Vertex 3
         } triangle;
+        struct {
+            float x, y;  // Emitter position
+            float delta_time;
+            uint32_t spawn_count;
+            float lifetime;  // seconds
+            float speed;     // pixels per second
+        } gpu_particles;
+        struct {
+            float x, y;  // Top-left corner
+            float width, height;
+            SpriteId id;
+        } sprite;
+        struct {
+            uint32_t id;
+            bool has_content;  // content follows, otherwise draw resident
+            uint32_t first_entry;  // into the push buffer's static_arena
+            uint32_t entry_count;
+            uint64_t hash;  // of the content, resident or following
+        } static_layer;
     } data;
-    float color[3];  // RGB color
+    float color[3];  // RGB color, multiplies the texture for sprites
+};
+
+// 2D camera in pixels: screen = (world - position) * zoom. The renderer
+// builds the view matrix from it and culls against the visible rectangle.
+struct RenderCamera {
+    float x, y;  // World position at the top-left of the screen
+    float zoom;
+};
+
+// Mesh and sprite instances the renderer takes per frame, outside static
+// layers. Entries drawn after the frame is full are dropped.
+const uint32_t MAX_FRAME_INSTANCES = 1 << 19;
+
+const uint32_t STATIC_LAYER_MAX = 8;
+
+// NOTE: Retained layer, owned by the game. Its content is only drawn
+// between BeginStaticLayer and EndStaticLayer when dirty. The renderer
+// converts it once into a device buffer and draws it from there every
+// frame the layer is referenced, with no per-frame conversion or upload.
+// Content that hashes the same as what is resident isn't uploaded again,
+// so marking a layer dirty more often than needed is cheap.
+struct StaticLayer {
+    uint32_t id;    // < STATIC_LAYER_MAX, one resident buffer per id
+    bool dirty;     // set by the game whenever the content changes
+    uint64_t hash;  // of the content last handed to the renderer
 };
 
 struct PushBuffer {
     MemoryArena arena;
     uint32_t number_of_entries = 0;
+    uint8_t current_layer = 0;  // Layer stamped into new entries' sort keys
+    RenderCamera camera = {0.0f, 0.0f, 1.0f};
+    // One bit per layer, set for layers drawn in screen pixels that ignore
+    // the camera
+    uint64_t screen_space_layers[4] = {};
+
+    // Content of static layers, only written while one is open
+    MemoryArena static_arena;
+    uint32_t number_of_static_entries = 0;
+    PushBufferEntry* open_static_layer = 0;  // its reference entry
+    // Filled in by the renderer when it is done with the push buffer and
+    // handed back to the game with it: the hash of each static layer's
+    // resident content, 0 when it has none
+    uint64_t resident_static_hashes[STATIC_LAYER_MAX] = {};
 };
+
+inline bool IsScreenSpaceLayer(const PushBuffer* pb, uint8_t layer) {
+    return (pb->screen_space_layers[layer >> 6] >> (layer & 63)) & 1;
+}